@@ -18,11 +18,8 @@
 #include "hal.h"
 #include "usbcfg.h"
 #include "bbi2c.h"
-#include "debug.h"
 #include "ddcci.h"
-
-#include "shell.h"
-#include "chprintf.h"
+#include "log.h"
 
 uint8_t edidstring[18] = /* writing 'owned' as the display name string */
 {0x6F, 0x77, 0x6E, 0x65, 0x64,
@@ -35,20 +32,14 @@ int rand(void);
 void randomSeed(unsigned int seed);
 long random(long max);
 
-uint8_t * edid_monitor_string_faker (uint8_t *edid)
+/* writes 'owned' into the display name of 'edid' in place */
+void edid_monitor_string_faker (uint8_t *edid)
 {
-  static uint8_t newEdid[128];
   uint8_t i, k;
   uint8_t length = 128;
   uint32_t sum = 0;
   uint8_t checksum = 0;
-
-  chprintf(&SDU1, "changing edid\r\n");
-
-  for(i = 0; i < 128; i++)
-  {
-    newEdid[i] = edid[i];
-  }
+  uint8_t found = 0;
 
   /* search for the 00 00 FC 00 Block in the descriptor blocks */
   for(i = 54; i < length; i++)
@@ -58,40 +49,34 @@ uint8_t * edid_monitor_string_faker (uint8_t *edid)
       if(edid[i+1] == 0x00 && edid[i+1] == 0x00 && edid[i+2] == 0xFC &&
           edid[i+3] == 0x00)
           {
-            chprintf(&SDU1, "found sequence\r\n");
+            LOG_EVENT (LOG_ATTACK_NAME_REPLACED, i, 0);
+            found = 1;
             for(k = 0; k < 13; k++)
             {
-              newEdid[i+4] = edidstring[k]; /* replaces by 'owned' */
+              edid[i+4] = edidstring[k]; /* replaces by 'owned' */
               i++;
             }
             break;
           }
     }
   }
+  if (!found) LOG_EVENT (LOG_ATTACK_NAME_MISSING, 0, 0);
 
   /* calculate checksum */
   for(i = 0; i < 127; i++)
   {
-    sum += newEdid[i];
+    sum += edid[i];
   }
   checksum = 256 - (sum % 256);
-  newEdid[127] = checksum;
+  edid[127] = checksum;
   sum = 0;
 
-
-  chprintf(&SDU1, "faked edid:\r\n");
-  for (i = 0; i < 128; i++)
-  {
-    chprintf(&SDU1, "%02x ", newEdid[i]);
-  }
-  chprintf(&SDU1, "\r\n");
-  return newEdid;
+  LOG_BYTES (LOG_ATTACK_EDID, edid, EDID_LENGTH);
 }
 
-/* fuzzes a random element of the EDID */
-uint8_t * edid_fuzzer_unary (uint8_t *savedEDID)
+/* fuzzes a random element of the EDID in place */
+void edid_fuzzer_unary (uint8_t *edid)
 {
-  static uint8_t edid[128];
   uint32_t element, value;
   uint8_t i;
   uint32_t sum = 0;
@@ -100,17 +85,9 @@ uint8_t * edid_fuzzer_unary (uint8_t *savedEDID)
   element = (chVTGetSystemTime() % 127);
   value = (chVTGetSystemTime() % 256);
 
-  chprintf(&SDU1, "Some random numbers\r\n");
-  chprintf(&SDU1, "%d %d \r\n", chVTGetSystemTime() % 127, chVTGetSystemTime() % 127);
-
   /* Prevent to change the header */
   while(element < 8) element = (chVTGetSystemTime() % 127);
 
-  for(uint8_t z = 0; z < 128; z++)
-  {
-    edid[z] = savedEDID [z];
-  }
-
   edid[element] = value;
 
   /* calculate checksum */
@@ -122,22 +99,13 @@ uint8_t * edid_fuzzer_unary (uint8_t *savedEDID)
   edid[127] = checksum;
   sum = 0;
 
-  chprintf(&SDU1, "Changed Byte Number %d to %02x", element, value);
-
-  for(uint8_t l = 0; l < 128; l++)
-  {
-    chprintf(&SDU1, "%02x ", edid[l]);
-  }
-
-  chprintf(&SDU1, "\r\n");
-
-  return edid;
+  LOG_EVENT (LOG_ATTACK_FUZZED, element, value);
+  LOG_BYTES (LOG_ATTACK_EDID, edid, EDID_LENGTH);
 }
 
-/* modifies the complete EDID but the header and the checksum */
-uint8_t * edid_fuzzer_complete (void)
+/* fills 'edid' with random data but the header and the checksum */
+void edid_fuzzer_complete (uint8_t *edid)
 {
-  static uint8_t edid[128];
   uint8_t value, i;
   uint32_t sum = 0;
   uint8_t checksum = 0;
@@ -168,10 +136,5 @@ uint8_t * edid_fuzzer_complete (void)
   edid[127] = checksum;
   sum = 0;
 
-  for(uint8_t l = 0; l < 128; l++)
-  {
-    chprintf(&SDU1, "%02x ", edid[l]);
-  }
-
-  return edid;
+  LOG_BYTES (LOG_ATTACK_EDID, edid, EDID_LENGTH);
 }
@@ -17,9 +17,9 @@
 #ifndef ATTACKS_H
 #define ATTACKS_H
 
-uint8_t * edid_monitor_string_faker (uint8_t *edid);
-uint8_t * edid_fuzzer_unary (uint8_t *savedEDID);
-uint8_t * edid_fuzzer_complete (void);
-uint8_t * edid_fuzzer_unary (uint8_t *savedEDID);
+/* all transform a caller-supplied EDID_LENGTH buffer in place */
+void edid_monitor_string_faker (uint8_t *edid);
+void edid_fuzzer_unary (uint8_t *edid);
+void edid_fuzzer_complete (uint8_t *edid);
 
 #endif
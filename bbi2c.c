@@ -17,6 +17,18 @@
 #include "bbi2c.h"
 #include "debug.h"
 #include "usbcfg.h"
+#include "trace.h"
+#include "timing.h"
+#include "i2ctiming.h"
+#include "stats.h"
+#include "log.h"
+
+#define TRACE_BUS(dev) ((dev)->mode == BBI2C_MODE_SLAVE ? TRACE_BUS_HOST : TRACE_BUS_MONITOR)
+#define TIMING_BUS(dev) ((dev)->mode == BBI2C_MODE_SLAVE ? TIMING_RECORD_HOST : TIMING_RECORD_MONITOR)
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+#define STRETCH_TIMEOUT (BBI2C_STRETCH_TIMEOUT_US * CYCLES_PER_US)
+#define HOST_TIMEOUT (BBI2C_HOST_TIMEOUT_US * CYCLES_PER_US)
 
 static inline void Delay_us (uint32_t interval)
 {
@@ -31,15 +43,43 @@ static inline void Delay_us (uint32_t interval)
     }
 }
 
+/* Count a bus event if the owner of the device keeps statistics */
+static inline void Count (BBI2C_t *dev, stats_counter_t counter, uint32_t value)
+{
+    if (dev->stats) stats_add (dev->stats, counter, value);
+}
+
+/* Busy wait until 'cycles' have passed since 'since' */
+static inline void Wait_Cycles (rtcnt_t since, uint32_t cycles)
+{
+    while (chSysGetRealtimeCounterX() - since < cycles);
+}
+
+/* Record the current line levels while a bus trace or timing measurement is running */
+static inline void Trace_Lines (BBI2C_t *dev)
+{
+    int sda, scl;
+
+    if (trace_recording || timing_recording)
+    {
+        sda = palReadPad (dev->sda_gpio, dev->sda_pin);
+        scl = palReadPad (dev->scl_gpio, dev->scl_pin);
+        trace_lines (TRACE_BUS (dev), sda, scl);
+        timing_lines (TIMING_BUS (dev), sda, scl);
+    }
+}
+
 int Read_SDA (BBI2C_t *dev)
 {
     int result;
+    Trace_Lines (dev);
     result = palReadPad (dev->sda_gpio, dev->sda_pin);
     return result;
 };
 
 int Read_SCL (BBI2C_t *dev)
 {
+    Trace_Lines (dev);
     return palReadPad (dev->scl_gpio, dev->scl_pin);
 };
 
@@ -53,6 +93,7 @@ void Drive_SDA (BBI2C_t *dev, int sda)
     {
         palClearPad (dev->sda_gpio, dev->sda_pin);
     }
+    Trace_Lines (dev);
 }
 
 void Drive_SCL (BBI2C_t *dev, int scl)
@@ -65,21 +106,194 @@ void Drive_SCL (BBI2C_t *dev, int scl)
     {
         palClearPad (dev->scl_gpio, dev->scl_pin);
     }
+    Trace_Lines (dev);
+}
+
+/*
+ * Wait for a stretching slave to release SCL, -1 if it still holds it
+ * after 'timeout' cycles. SCL is read once more after the deadline, the
+ * thread may have been preempted by a proxy serving another port.
+ */
+static int Wait_SCL_High (BBI2C_t *dev, uint32_t timeout)
+{
+    rtcnt_t start = chSysGetRealtimeCounterX();
+
+    while (!Read_SCL (dev))
+    {
+        if (chSysGetRealtimeCounterX() - start >= timeout && !Read_SCL (dev)) return -1;
+    }
+    dev->scl_edge = chSysGetRealtimeCounterX();
+    return 0;
+}
+
+static void Pull_SCL (BBI2C_t *dev)
+{
+    Drive_SCL (dev, 0);
+    dev->scl_edge = chSysGetRealtimeCounterX();
 }
 
-void Release_SCL (BBI2C_t *dev)
+/*
+ * Free the bus from a slave stuck in the middle of a byte: clock until it
+ * releases SDA, at most 9 times, then send STOP. Gives up as soon as SCL
+ * is held longer than a slave may stretch it. Returns 0 if the bus is idle
+ * afterwards.
+ */
+static int Recover (BBI2C_t *dev)
 {
+    rtcnt_t start = chSysGetRealtimeCounterX();
+    uint32_t elapsed;
+    int i, status;
+
+    Drive_SDA (dev, 1);
     Drive_SCL (dev, 1);
-    while (!Read_SCL (dev));
+    status = Wait_SCL_High (dev, STRETCH_TIMEOUT);
+
+    for (i = 0; status == 0 && i < 9 && !Read_SDA (dev); i++)
+    {
+        Wait_Cycles (dev->scl_edge, dev->t_high);
+        Pull_SCL (dev);
+        Wait_Cycles (dev->scl_edge, dev->t_low);
+        Drive_SCL (dev, 1);
+        status = Wait_SCL_High (dev, STRETCH_TIMEOUT);
+    }
+
+    if (status == 0)
+    {
+        Wait_Cycles (dev->scl_edge, dev->t_high);
+        Pull_SCL (dev);
+        Drive_SDA (dev, 0);
+        Wait_Cycles (dev->scl_edge, dev->t_low);
+        Drive_SCL (dev, 1);
+        status = Wait_SCL_High (dev, STRETCH_TIMEOUT);
+        Wait_Cycles (dev->scl_edge, dev->t_high);
+        Drive_SDA (dev, 1);
+        Wait_Cycles (chSysGetRealtimeCounterX(), dev->t_low);
+        if (status == 0 && !Read_SDA (dev)) status = -1;
+    }
+
+    elapsed = (chSysGetRealtimeCounterX() - start) / CYCLES_PER_US;
+    Count (dev, status == 0 ? STATS_RECOVERY : STATS_STUCK, 1);
+    Count (dev, STATS_RECOVERY_US, elapsed);
+    LOG_EVENT (LOG_BUS_RECOVERY, elapsed, status);
+    return status;
 }
 
-void Check_Stretch_SCL (BBI2C_t *dev)
+/*
+ * Release SCL and wait for a stretching slave, the high phase starts now.
+ * A slave holding SCL too long aborts the transfer and the bus is recovered.
+ */
+static int Release_SCL (BBI2C_t *dev)
 {
-    int clock = 0;
-    while (clock == 0){
-    	clock = Read_SCL (dev);
+    Drive_SCL (dev, 1);
+    if (Wait_SCL_High (dev, STRETCH_TIMEOUT) == 0) return 0;
+
+    Count (dev, STATS_TIMEOUT, 1);
+    dev->error = 1;
+    Recover (dev);
+    return -1;
+}
+
+/* Split the SCL period in the proportion of the minimum low and high times of its mode */
+static void Master_Timing (BBI2C_t *dev, unsigned long frequency)
+{
+    uint32_t period = STM32_HCLK / frequency;
+    uint32_t low, high, unused;
+
+    i2c_timing_limits (I2C_TIMING_SCL_LOW, frequency, &low, &unused);
+    i2c_timing_limits (I2C_TIMING_SCL_HIGH, frequency, &high, &unused);
+
+    dev->t_low = period * low / (low + high);
+    if (dev->t_low < (low * CYCLES_PER_US + 999) / 1000) dev->t_low = (low * CYCLES_PER_US + 999) / 1000;
+    dev->t_high = period - dev->t_low;
+    if (dev->t_high < (high * CYCLES_PER_US + 999) / 1000) dev->t_high = (high * CYCLES_PER_US + 999) / 1000;
+}
+
+/*
+ * Clock one bit as master, SCL is low on entry and on return. SDA is set
+ * right after SCL fell, which keeps the hold time short and leaves the
+ * whole low phase as setup time. Returns SDA at the end of the high phase.
+ */
+static int Master_Bit (BBI2C_t *dev, int bit)
+{
+    int sda;
+
+    if (dev->error) return 1;
+
+    Drive_SDA (dev, bit);
+    Wait_Cycles (dev->scl_edge, dev->t_low);
+    if (Release_SCL (dev) < 0) return 1;
+    Wait_Cycles (dev->scl_edge, dev->t_high);
+    sda = Read_SDA (dev);
+    Pull_SCL (dev);
+    return sda;
+}
+
+/* The host stopped clocking, let go of SDA so it can start over */
+static int Slave_Timeout (BBI2C_t *dev)
+{
+    Drive_SDA (dev, 1);
+    dev->last_sda = Read_SDA (dev);
+    dev->last_scl = Read_SCL (dev);
+    dev->state = BS_Wait_Start;
+    Count (dev, STATS_TIMEOUT, 1);
+    return BBI2C_TIMEOUT;
+}
+
+/* Wait for the master to pull SCL low, returns 2 on STOP and 3 on START meanwhile */
+static int Slave_Wait_Low (BBI2C_t *dev)
+{
+    rtcnt_t start = chSysGetRealtimeCounterX();
+    uint32_t sda = palReadPad (dev->sda_gpio, dev->sda_pin);
+
+    while (palReadPad (dev->scl_gpio, dev->scl_pin))
+    {
+        if (palReadPad (dev->sda_gpio, dev->sda_pin) != sda)
+        {
+            Trace_Lines (dev);
+            return sda ? BBI2C_START : BBI2C_STOP;
+        }
+        if (chSysGetRealtimeCounterX() - start >= HOST_TIMEOUT) return Slave_Timeout (dev);
+    }
+    Trace_Lines (dev);
+    return 0;
+}
+
+static int Slave_Wait_High (BBI2C_t *dev)
+{
+    rtcnt_t start = chSysGetRealtimeCounterX();
+
+    while (!palReadPad (dev->scl_gpio, dev->scl_pin))
+    {
+        if (chSysGetRealtimeCounterX() - start >= HOST_TIMEOUT) return Slave_Timeout (dev);
+    }
+    Trace_Lines (dev);
+    return 0;
+}
+
+/* Sampling interval of all slave devices chosen for the attached host, -1 derives it from their frequency */
+static long slave_delay_us = -1;
+
+void BBI2C_Set_Slave_Delay (long delay_us)
+{
+    slave_delay_us = delay_us;
+}
+
+/* Derive the timing of the mode from the nominal SCL frequency */
+static int Configure (BBI2C_t *dev, unsigned long frequency)
+{
+    switch (dev->mode)
+    {
+        case BBI2C_MODE_SLAVE:
+            dev->delay_us = 1000000 / frequency / 4;
+            break;
+        case BBI2C_MODE_MASTER:
+            Master_Timing (dev, frequency);
+            break;
+        default:
+            return -1;
     }
-   // Drive_SCL (dev, 1);
+    dev->frequency = frequency;
+    return 0;
 }
 
 int BBI2C_Init
@@ -99,20 +313,11 @@ int BBI2C_Init
     dev->last_scl = 1;
     dev->last_sda = 1;
     dev->state    = BS_Wait_Start;
+    dev->scl_edge = chSysGetRealtimeCounterX();
+    dev->error    = 0;
+    dev->stats    = NULL;
 
-    switch (mode)
-    {
-        case BBI2C_MODE_INVALID:
-            return -1;
-        case BBI2C_MODE_SLAVE:
-            dev->delay_us = 1000000 / frequency / 4;
-            break;
-        case BBI2C_MODE_MASTER:
-            dev->delay_us = 1000000 / frequency / 3;
-            break;
-        default:
-            return -1;
-    }
+    if (Configure (dev, frequency) < 0) return -1;
 
     palSetPadMode(dev->scl_gpio, dev->scl_pin, PAL_MODE_OUTPUT_OPENDRAIN | PAL_STM32_OSPEED_HIGHEST);
     palSetPadMode(dev->sda_gpio, dev->sda_pin, PAL_MODE_OUTPUT_OPENDRAIN | PAL_STM32_OSPEED_HIGHEST);
@@ -123,89 +328,98 @@ int BBI2C_Init
     return 0;
 }
 
-static BBI2C_Event_t BBI2C_Event (BBI2C_t *dev)
+/*
+ * Change the SCL frequency of a device set up before. Only the timing is
+ * recomputed, the lines and the bus history stay untouched; nothing at all
+ * happens if the frequency is the same.
+ */
+int BBI2C_Set_Frequency (BBI2C_t *dev, unsigned long frequency)
+{
+    if (frequency == dev->frequency) return 0;
+    return Configure (dev, frequency);
+}
+
+/* Forget the bus history after the lines have not been sampled for a while */
+void BBI2C_Resync (BBI2C_t *dev)
 {
-    BBI2C_Event_t result;
+    dev->last_sda = Read_SDA (dev);
+    dev->last_scl = Read_SCL (dev);
+    dev->state    = BS_Wait_Start;
+}
+
+/* Wait for the lines to change, -1 if they did not within 'timeout' cycles (0 waits forever) */
+static int BBI2C_Event (BBI2C_t *dev, BBI2C_Event_t *result, uint32_t timeout)
+{
+    rtcnt_t start = chSysGetRealtimeCounterX();
     int sda, scl;
 
     for (;;)
     {
         sda = palReadPad (dev->sda_gpio, dev->sda_pin);
         scl = palReadPad (dev->scl_gpio, dev->scl_pin);
-        Delay_us (dev->delay_us);
+        Delay_us (slave_delay_us >= 0 ? (unsigned long)slave_delay_us : dev->delay_us);
+
+        if (timeout && chSysGetRealtimeCounterX() - start >= timeout) return -1;
 
         if (sda != dev->last_sda || scl != dev->last_scl)
         {
+            trace_lines (TRACE_BUS (dev), sda, scl);
+            timing_lines (TIMING_BUS (dev), sda, scl);
+
             if (sda)
                 if (dev->last_sda)
-                    result.sda = BBI2C_LEVEL_HIGH;
+                    result->sda = BBI2C_LEVEL_HIGH;
                 else // !dev->last_sda
-                    result.sda = BBI2C_LEVEL_RAISE;
+                    result->sda = BBI2C_LEVEL_RAISE;
             else // !sda
                 if (dev->last_sda)
-                    result.sda = BBI2C_LEVEL_FALL;
+                    result->sda = BBI2C_LEVEL_FALL;
                 else // !dev->last_sda
-                    result.sda = BBI2C_LEVEL_LOW;
+                    result->sda = BBI2C_LEVEL_LOW;
 
             if (scl)
                 if (dev->last_scl)
-                    result.scl = BBI2C_LEVEL_HIGH;
+                    result->scl = BBI2C_LEVEL_HIGH;
                 else // !dev->last_scl
-                    result.scl = BBI2C_LEVEL_RAISE;
+                    result->scl = BBI2C_LEVEL_RAISE;
             else // !scl
                 if (dev->last_scl)
-                    result.scl = BBI2C_LEVEL_FALL;
+                    result->scl = BBI2C_LEVEL_FALL;
                 else // !dev->last_scl
-                    result.scl = BBI2C_LEVEL_LOW;
+                    result->scl = BBI2C_LEVEL_LOW;
 
             dev->last_sda = sda;
             dev->last_scl = scl;
-            return result;
+            return 0;
         }
     }
 }
 
-/* Read a byte from the master */
-uint8_t BBI2C_Get_Byte (BBI2C_t *dev)
+/*
+ * Read a byte from the master. With 'single' set only the current transfer
+ * is followed, -1 is returned on STOP and when the master stalls.
+ */
+static int Receive (BBI2C_t *dev, uint8_t *data, int single)
 {
 
     uint8_t result = 0;
     int count = 8;
 
-/* activate when debugging
-    typedef struct
-    {
-      BBI2C_State_t state;
-      BBI2C_Level_t sda;
-      BBI2C_Level_t scl;
-    } debug_t
-    BBI2C_State_t oldstate = 0;
-    debug_t transitions[15];
-    uint32_t tcounter = 0;
-*/
     for (;;)
     {
-        BBI2C_Event_t event = BBI2C_Event (dev);
+        BBI2C_Event_t event;
+        uint32_t timeout = 0;
 
-/* For debugging purpose
-	if (tcounter < (sizeof(transitions)/sizeof(debug_t)))
-	{
-	  if(oldstate!=dev->state || dev->state!=BS_Wait_Start)
-    {
-	     transitions[tcounter].state = dev->state;
-       transitions[tcounter].sda = event.sda;
-	     transitions[tcounter].scl = event.scl;
-	     tcounter++;
-    }
-	} else {
-	     	for(tcounter = 0; tcounter < 15; tcounter++)
-		{
-			chprintf(&SDU1,"%d/%d/%d ", transitions[tcounter].state, transitions[tcounter].sda, transitions[tcounter].scl);
-		}
-     	tcounter = 0;
-   	}
-  oldstate = dev->state;
-*/
+        /* while acknowledging we hold SDA, a host gone in between must not lock up the bus */
+        if (single || dev->state == BS_Ack || dev->state == BS_Ack_Done) timeout = HOST_TIMEOUT;
+        if (BBI2C_Event (dev, &event, timeout) < 0)
+        {
+            Slave_Timeout (dev);
+            if (single) return -1;
+            result = 0;
+            count = 8;
+            continue;
+        }
 
 	// Go to BS_Start whenever a start condition is encountered
         if (START_CONDITION (event))
@@ -218,6 +432,7 @@ uint8_t BBI2C_Get_Byte (BBI2C_t *dev)
       	if (STOP_CONDITION (event))
       	{
       	    dev->state = BS_Wait_Start;
+      	    if (single) return -1;
       	    continue;
       	}
 
@@ -268,7 +483,8 @@ uint8_t BBI2C_Get_Byte (BBI2C_t *dev)
                       {
                           Drive_SDA (dev, 1);
                           dev->state = BS_Clock_Avail;
-                          return result;
+                          *data = result;
+                          return 0;
                       }
                       break;
 
@@ -278,182 +494,122 @@ uint8_t BBI2C_Get_Byte (BBI2C_t *dev)
     }
 }
 
+/* Read a byte from the master, waiting for the next START after a STOP */
+uint8_t BBI2C_Get_Byte (BBI2C_t *dev)
+{
+    uint8_t data = 0;
+
+    Receive (dev, &data, 0);
+    return data;
+}
+
+/* Read the next byte of the current transfer, -1 on STOP or if the master stalled */
+int BBI2C_Receive_Byte (BBI2C_t *dev, uint8_t *data)
+{
+    return Receive (dev, data, 1);
+}
+
+/* The master sent START, detected elsewhere while the bus was not sampled */
+void BBI2C_Start_Seen (BBI2C_t *dev)
+{
+    dev->last_sda = 0;
+    dev->last_scl = 1;
+    dev->state    = BS_Start;
+}
+
+/*
+ * START from an idle bus or, as repeated START, with SCL low after a byte.
+ * A slave still driving SDA from an aborted transfer is clocked free first.
+ */
 void BBI2C_Start (BBI2C_t *dev)
 {
-    Release_SCL (dev);
+    dev->error = 0;
     Drive_SDA (dev, 1);
-    Delay_us (dev->delay_us);
+    Wait_Cycles (dev->scl_edge, dev->t_low);
+    if (Release_SCL (dev) < 0) return;
+    Wait_Cycles (dev->scl_edge, dev->t_low);  /* tSU;STA is longer than tHIGH in standard mode */
+    if (!Read_SDA (dev) && Recover (dev) < 0)
+    {
+        dev->error = 1;
+        return;
+    }
     Drive_SDA (dev, 0);
-    Delay_us (dev->delay_us);
+    Wait_Cycles (chSysGetRealtimeCounterX(), dev->t_high);
+    Pull_SCL (dev);
 }
 
+/* Nothing to do after a timeout, recovering the bus ended with STOP */
 void BBI2C_Stop (BBI2C_t *dev)
 {
+    if (dev->error) return;
     Drive_SDA (dev, 0);
-    Delay_us (dev->delay_us);
-    Release_SCL (dev);
-    Delay_us (dev->delay_us);
+    Wait_Cycles (dev->scl_edge, dev->t_low);
+    if (Release_SCL (dev) < 0) return;
+    Wait_Cycles (dev->scl_edge, dev->t_high);
     Drive_SDA (dev, 1);
-    Delay_us (dev->delay_us);
+    Wait_Cycles (chSysGetRealtimeCounterX(), dev->t_low);  /* tBUF, the next START may use another device */
 }
 
 void BBI2C_Ack (BBI2C_t *dev)
 {
-    Drive_SDA (dev, 0);
-    Delay_us (dev->delay_us);
-    Drive_SCL (dev, 1);
-    Delay_us (dev->delay_us);
-    Drive_SCL (dev, 0);
-    Drive_SDA (dev, 1);
-    Delay_us (dev->delay_us);
+    Master_Bit (dev, 0);
+    if (!dev->error) Drive_SDA (dev, 1);
 }
 
 void BBI2C_NACK (BBI2C_t *dev)
 {
-	Drive_SDA (dev, 1);
-    Delay_us (dev->delay_us);
-    Drive_SCL (dev, 1);
-    Delay_us (dev->delay_us);
-    Drive_SCL (dev, 0);
-    Delay_us (dev->delay_us);
+    Master_Bit (dev, 1);
 }
 
-/* Sends byte to slave by driving the SCL after a certain delay */
+/* Sends byte to slave, returns 1 if it was acknowledged, 0 on NACK or timeout */
 int BBI2C_Send_Byte (BBI2C_t *dev, uint8_t data)
 {
-    Drive_SCL (dev, 0);
+    uint8_t i;
 
-    unsigned char i, ack_bit;
-    for (i = 0; i < 8; i++)
-    { /* writing the bits */
-        if ((data & 0x80) == 0)
-        {
-            Drive_SDA (dev, 0);
-        }
-        else
-        {
-            Drive_SDA (dev, 1);
-        }
-
-        Delay_us (dev->delay_us);
-        Release_SCL (dev);
-        Delay_us (dev->delay_us);
-        Drive_SCL (dev, 0);
-        Delay_us (dev->delay_us);
-        data <<= 1;
-     }
-
-     Drive_SDA (dev, 1);
-     Delay_us (dev->delay_us);
-     Release_SCL (dev);
-     ack_bit = Read_SDA (dev); /* reading the ACK or NACK */
-
-     Delay_us (dev->delay_us);
-     Drive_SCL (dev, 0);
-     Check_Stretch_SCL (dev);
-
-     return (ack_bit == 0);
+    for (i = 0; i < 8; i++, data <<= 1)
+    {
+        Master_Bit (dev, data & 0x80);
+    }
+    return Master_Bit (dev, 1) == 0;
 }
 
 /* Receive a Byte from the Slave */
 void BBI2C_Recv_Byte (BBI2C_t *dev, uint8_t *result)
 {
-    int i;
-    *result = 0;
-
-    Drive_SCL (dev, 0);
+    uint8_t i;
 
+    *result = 0;
     for (i = 0; i < 8; i++)
     {
-        Delay_us (dev->delay_us);
-        Release_SCL (dev);
-        Delay_us (dev->delay_us);
-
-        if (Read_SDA (dev))
-        {
-            *result |=1;
-        }
-        if (i < 7)
-        {
-            *result = *result << 1;
-        }
-
-        Drive_SCL (dev, 0);
-        Delay_us (dev->delay_us);
-    }
-    if(i<8)
-    {
-      chprintf(&SDU1, "Receiving byte failed!");
+        *result = (*result << 1) | Master_Bit (dev, 1);
     }
-   	return;
 }
 
-/* Sends a byte to the master by using a state machine */
+/*
+ * Sends a byte to the master, following its clock edge by edge. Each bit
+ * is put on SDA as soon as SCL fell, the first one possibly right away if
+ * SCL already fell after the ACK clock of the previous byte. Returns the
+ * ACK bit of the master, BBI2C_STOP, BBI2C_START or BBI2C_TIMEOUT if the
+ * master stalled.
+ */
 int BBI2C_Send_Byte_To_Master (BBI2C_t *dev, uint8_t data)
 {
-    unsigned char ack_bit;
-    int count = 8;
-    dev->state = BS_Clock_Avail;
-    uint8_t init = 1;
+    int i, status, ack_bit;
 
-    for (;;)
+    for (i = 0; i < 8; i++, data <<= 1)
     {
-       BBI2C_Event_t event = BBI2C_Event (dev);
-
-       // Go to BS_Start whenever a start condition is encountered
-       if (START_CONDITION (event))
-       {
-    	    return 3;
-       }
-       if (STOP_CONDITION (event))
-       {
-    	    return 2;
-       }
-
-       switch (dev->state)
-       {
-              case BS_Clock_Avail:
-                if (SCL_FALLING (event) || init == 1)
-                {
-                    init = 0;
-      		          if (count)
-                    {
-      			            if ((data & 0x80) == 0)
-          	   	        {
-             				 	      Drive_SDA (dev, 0);
-             		    	  }
-             		    	  else
-             		        {
-             		        		Drive_SDA (dev, 1);
-             		    	  }
-              	        count--;
-                        dev->state = BS_Data;
-             		        data <<= 1;
-      		     		  }
-      		     		  else
-      		     		  {
-      					        dev->state = BS_Ack;
-      		     		  }
-                }
-                break;
-              case BS_Data:
-                if(SCL_RAISING (event))
-                {
-                  dev->state = BS_Clock_Avail;
-                }
-                break;
-              case BS_Ack:
-                if (SCL_RAISING (event))
-                {
-                  ack_bit = Read_SDA (dev);
-                  dev->state = BS_Clock_Avail;
-                  return ack_bit;
-                }
-                break;
-
-
-          default:
-              break;
-        }
-      }
+        if ((status = Slave_Wait_Low (dev)) != 0) return status;
+        Drive_SDA (dev, data & 0x80);
+        if ((status = Slave_Wait_High (dev)) != 0) return status;
+    }
+
+    if ((status = Slave_Wait_Low (dev)) != 0) return status;
+    Drive_SDA (dev, 1); /* the master acknowledges */
+    if ((status = Slave_Wait_High (dev)) != 0) return status;
+    ack_bit = Read_SDA (dev);
+
+    dev->last_sda = ack_bit;
+    dev->last_scl = 1;
+    dev->state = BS_Clock_Avail;
+    return ack_bit;
 }
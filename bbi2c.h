@@ -18,6 +18,18 @@
 #define BBI2C_H
 
 #include "hal.h"
+#include "stats.h"
+
+/* Longest a slave may stretch SCL before the master aborts the transfer and recovers the bus */
+#define BBI2C_STRETCH_TIMEOUT_US 5000
+
+/* Longest the host may stall its clock in the middle of a byte the slave takes part in */
+#define BBI2C_HOST_TIMEOUT_US 25000
+
+/* Results of BBI2C_Send_Byte_To_Master besides the ACK bit */
+#define BBI2C_TIMEOUT -1  /* the host stopped clocking */
+#define BBI2C_STOP     2  /* the host ended the transfer */
+#define BBI2C_START    3  /* the host started another transfer */
 
 typedef enum
 {
@@ -69,7 +81,13 @@ typedef struct
     int sda_pin;
     stm32_gpio_t *scl_gpio;
     int scl_pin;
-    unsigned long delay_us;
+    unsigned long frequency; /* nominal SCL frequency the timing is derived from */
+    unsigned long delay_us;  /* slave: line sampling interval */
+    uint32_t t_low;          /* master: SCL low time in cycles */
+    uint32_t t_high;         /* master: SCL high time in cycles */
+    rtcnt_t scl_edge;        /* master: when SCL last changed */
+    int error;               /* master: transfer aborted by a bus timeout, cleared by Start */
+    stats_t *stats;          /* counters of the bus, none if NULL */
     BBI2C_Mode_t mode;
     int last_scl;
     int last_sda;
@@ -85,16 +103,24 @@ int BBI2C_Init
      unsigned long frequency,
      BBI2C_Mode_t mode);
 
+/* Override the sampling interval of slave devices initialized from now on, -1 to undo */
+void BBI2C_Set_Slave_Delay (long delay_us);
+
+void BBI2C_Resync (BBI2C_t *dev);
 void BBI2C_Start (BBI2C_t *dev);
 void BBI2C_Restart (BBI2C_t *dev);
 void BBI2C_Stop (BBI2C_t *dev);
-void BBI2C_ACK (BBI2C_t *dev);
+void BBI2C_Ack (BBI2C_t *dev);
 void BBI2C_NACK (BBI2C_t *dev);
 
 int BBI2C_Send_Byte (BBI2C_t *dev, uint8_t data);
 void BBI2C_Recv_Byte (BBI2C_t *dev, uint8_t *data);
 int BBI2C_Send_Byte_To_Master (BBI2C_t *dev, uint8_t data);
 
+int BBI2C_Set_Frequency (BBI2C_t *dev, unsigned long frequency);
+
 uint8_t BBI2C_Get_Byte (BBI2C_t *dev);
+int BBI2C_Receive_Byte (BBI2C_t *dev, uint8_t *data);
+void BBI2C_Start_Seen (BBI2C_t *dev);
 
 #endif // BBI2C_H
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "ch.h"
+#include "hal.h"
+#include "capture.h"
+
+/* TIM2 is the system tick, TIM3 update requests are served by DMA1 channel 3 */
+#define CAPTURE_TIM STM32_TIM3
+#define CAPTURE_DMA STM32_DMA1_STREAM3
+
+static uint16_t samples[CAPTURE_SAMPLES];
+static capture_edge_t edges[CAPTURE_EDGES];
+static volatile uint16_t head;  /* written by the DMA interrupt */
+static volatile uint16_t tail;  /* read by the consumer */
+static uint16_t mask;
+static uint16_t level;           /* last masked sample */
+static uint32_t cyclesPerSample;
+static volatile uint32_t now;    /* capture time of the next sample to handle */
+static uint32_t lost;
+static uint8_t  running;
+
+static BSEMAPHORE_DECL(ready, true);
+
+/* find the edges in one half of the DMA buffer */
+static void capture_isr (void *p, uint32_t flags)
+{
+  const uint16_t *sample = (flags & STM32_DMA_ISR_TCIF) ? &samples[CAPTURE_SAMPLES / 2] : samples;
+  uint16_t i, port;
+
+  (void)p;
+
+  for (i = 0; i < CAPTURE_SAMPLES / 2; i++, now += cyclesPerSample)
+  {
+    port = sample[i] & mask;
+    if (port == level) continue;
+    level = port;
+
+    if (((head - tail) & 0xFFFF) == CAPTURE_EDGES)
+    {
+      lost++;
+      continue;
+    }
+    edges[head & (CAPTURE_EDGES - 1)].time = now;
+    edges[head & (CAPTURE_EDGES - 1)].port = port;
+    head++;
+  }
+
+  /* wake the consumer once there is something worth the context switch */
+  if (((head - tail) & 0xFFFF) >= CAPTURE_EDGES / 4)
+  {
+    chSysLockFromISR ();
+    chBSemSignalI (&ready);
+    chSysUnlockFromISR ();
+  }
+}
+
+/* start sampling the GPIOC pins in 'mask' at 'rate' samples per second */
+int capture_start (uint16_t pins, uint32_t rate)
+{
+  if (running || rate == 0 || rate > STM32_TIMCLK1 / 8) return -1;
+  if (dmaStreamAllocate (CAPTURE_DMA, 12, capture_isr, NULL)) return -1;
+
+  mask = pins;
+  level = palReadPort (GPIOC) & mask;
+  head = tail = 0;
+  now = 0;
+  lost = 0;
+  cyclesPerSample = STM32_HCLK / rate;
+  running = 1;
+
+  dmaStreamSetPeripheral (CAPTURE_DMA, &GPIOC->IDR);
+  dmaStreamSetMemory0 (CAPTURE_DMA, samples);
+  dmaStreamSetTransactionSize (CAPTURE_DMA, CAPTURE_SAMPLES);
+  dmaStreamSetMode (CAPTURE_DMA, STM32_DMA_CR_PL(3) | STM32_DMA_CR_DIR_P2M | STM32_DMA_CR_PSIZE_HWORD |
+                    STM32_DMA_CR_MSIZE_HWORD | STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC |
+                    STM32_DMA_CR_HTIE | STM32_DMA_CR_TCIE);
+  dmaStreamEnable (CAPTURE_DMA);
+
+  rccEnableTIM3 (FALSE);
+  CAPTURE_TIM->CR1  = 0;
+  CAPTURE_TIM->PSC  = 0;
+  CAPTURE_TIM->ARR  = STM32_TIMCLK1 / rate - 1;
+  CAPTURE_TIM->EGR  = STM32_TIM_EGR_UG;
+  CAPTURE_TIM->SR   = 0;
+  CAPTURE_TIM->DIER = STM32_TIM_DIER_UDE;
+  CAPTURE_TIM->CR1  = STM32_TIM_CR1_CEN;
+
+  return 0;
+}
+
+void capture_stop (void)
+{
+  if (!running) return;
+
+  CAPTURE_TIM->CR1 = 0;
+  CAPTURE_TIM->DIER = 0;
+  rccDisableTIM3 (FALSE);
+  dmaStreamDisable (CAPTURE_DMA);
+  dmaStreamRelease (CAPTURE_DMA);
+  running = 0;
+}
+
+uint16_t capture_wait (systime_t timeout)
+{
+  if (head == tail) chBSemWaitTimeout (&ready, timeout);
+  return (head - tail) & 0xFFFF;
+}
+
+uint16_t capture_read (capture_edge_t *out, uint16_t max)
+{
+  uint16_t n = 0;
+
+  while (n < max && tail != head)
+  {
+    out[n++] = edges[tail & (CAPTURE_EDGES - 1)];
+    tail++;
+  }
+  return n;
+}
+
+uint32_t capture_time (void)
+{
+  return now;
+}
+
+uint32_t capture_lost (void)
+{
+  return lost;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/*
+ * GPIOC is sampled by DMA at a fixed rate paced by TIM3 update events,
+ * the DMA interrupt turns the samples into timestamped edges. The bus
+ * pins have no timer capture channels, so this is as close to hardware
+ * timestamps as the board gets: the resolution is one sample period.
+ */
+
+/* Samples per second, 2 MHz resolves 100 kHz SCL to 0.5 us */
+#define CAPTURE_RATE 2000000
+
+/* DMA buffer in samples, the interrupt handles one half at a time */
+#define CAPTURE_SAMPLES 512
+
+/* Edges waiting for the consumer, must be a power of two */
+#define CAPTURE_EDGES 512
+
+typedef struct
+{
+    uint32_t time;  /* CPU cycles since capture_start, from the sample index */
+    uint16_t port;  /* masked GPIOC levels after the edge */
+} capture_edge_t;
+
+int capture_start (uint16_t mask, uint32_t rate);
+void capture_stop (void);
+
+/* wait until edges are pending or the timeout expires, returns the number pending */
+uint16_t capture_wait (systime_t timeout);
+uint16_t capture_read (capture_edge_t *edges, uint16_t max);
+
+/* capture time of the last sample handled */
+uint32_t capture_time (void);
+
+/* edges dropped because the consumer was too slow */
+uint32_t capture_lost (void);
+
+#endif // CAPTURE_H
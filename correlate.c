@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Side channel of the proxy loop and the upstream worker relating both
+ * buses: every proxied request is followed from the host bus to the
+ * monitor and back. Both sides only store a cycle counter timestamp at
+ * the transaction boundaries they already pass, the latency the proxy
+ * adds is worked out when printing.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "correlate.h"
+
+#include "chprintf.h"
+
+#define CORRELATE_REPLY     0x01  /* the host expects a reply */
+#define CORRELATE_MONITOR   0x02  /* the monitor was asked */
+#define CORRELATE_FAILED    0x04  /* ... but did not answer */
+#define CORRELATE_DELIVERED 0x08  /* the host got the reply */
+#define CORRELATE_TIMEOUT   0x10  /* the host gave up and sent a new request */
+#define CORRELATE_PROXY     0x20  /* ... although the monitor answered in time */
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+
+typedef struct
+{
+  uint32_t sequence;
+  uint8_t  opcode;
+  uint8_t  flags;
+  uint8_t  nulls;        /* null messages the host got meanwhile */
+  rtcnt_t  hostRequest;
+  rtcnt_t  monitorStart;
+  rtcnt_t  monitorEnd;
+  rtcnt_t  hostReply;    /* reply delivered, or the last null message */
+} correlate_entry_t;
+
+static correlate_entry_t entries[CORRELATE_DEPTH];
+static uint32_t timeouts;
+static uint32_t proxyTimeouts;
+
+static correlate_entry_t * correlate_entry (uint32_t sequence)
+{
+  correlate_entry_t *entry = &entries[sequence & (CORRELATE_DEPTH - 1)];
+
+  return entry->sequence == sequence ? entry : NULL;
+}
+
+/* a request left without reply when the next one arrives timed out on the host */
+static void correlate_abandoned (correlate_entry_t *entry)
+{
+  if (!(entry->flags & CORRELATE_REPLY) || (entry->flags & CORRELATE_DELIVERED)) return;
+
+  entry->flags |= CORRELATE_TIMEOUT;
+  timeouts++;
+
+  /* connected directly, the host would have had the reply before its last attempt */
+  if ((entry->flags & (CORRELATE_MONITOR | CORRELATE_FAILED)) == CORRELATE_MONITOR && entry->nulls &&
+      entry->monitorEnd - entry->monitorStart < entry->hostReply - entry->hostRequest)
+  {
+    entry->flags |= CORRELATE_PROXY;
+    proxyTimeouts++;
+  }
+}
+
+void correlate_request (uint32_t sequence, uint8_t opcode, int reply, rtcnt_t start)
+{
+  correlate_entry_t *entry = &entries[sequence & (CORRELATE_DEPTH - 1)];
+  correlate_entry_t *previous = correlate_entry (sequence - 1);
+
+  if (entry->sequence == sequence && entry->hostRequest) return; /* host retry */
+
+  if (previous) correlate_abandoned (previous);
+
+  entry->sequence = sequence;
+  entry->opcode = opcode;
+  entry->flags = reply ? CORRELATE_REPLY : 0;
+  entry->nulls = 0;
+  entry->hostRequest = start;
+  entry->hostReply = 0;
+}
+
+void correlate_monitor (uint32_t sequence, rtcnt_t start, rtcnt_t end, int status)
+{
+  correlate_entry_t *entry = correlate_entry (sequence);
+
+  if (!entry) return;
+  entry->monitorStart = start;
+  entry->monitorEnd = end;
+  entry->flags |= CORRELATE_MONITOR | (status ? CORRELATE_FAILED : 0);
+}
+
+void correlate_reply (uint32_t sequence)
+{
+  correlate_entry_t *entry = correlate_entry (sequence);
+
+  if (!entry || (entry->flags & CORRELATE_DELIVERED)) return;
+  entry->hostReply = chSysGetRealtimeCounterX();
+  entry->flags |= CORRELATE_DELIVERED;
+}
+
+void correlate_null (uint32_t sequence)
+{
+  correlate_entry_t *entry = correlate_entry (sequence);
+
+  if (!entry || (entry->flags & CORRELATE_DELIVERED)) return;
+  entry->hostReply = chSysGetRealtimeCounterX();
+  if (entry->nulls < 0xFF) entry->nulls++;
+}
+
+void correlate_reset (void)
+{
+  uint8_t i;
+
+  for (i = 0; i < CORRELATE_DEPTH; i++)
+  {
+    entries[i].sequence = 0;
+    entries[i].hostRequest = 0;
+  }
+  timeouts = 0;
+  proxyTimeouts = 0;
+}
+
+/* oldest first; host is the wait seen by the host, added what the proxy put on top of the monitor */
+void correlate_print (BaseSequentialStream *chp)
+{
+  correlate_entry_t entry;
+  uint32_t newest = 0, sequence, host, monitor;
+  uint8_t i;
+
+  for (i = 0; i < CORRELATE_DEPTH; i++)
+  {
+    if (entries[i].hostRequest && entries[i].sequence > newest) newest = entries[i].sequence;
+  }
+
+  chprintf (chp, "%8s %6s %10s %10s %10s %5s\r\n", "seq", "opcode", "host/us", "monitor/us", "added/us", "nulls");
+  for (sequence = newest - CORRELATE_DEPTH + 1; sequence != newest + 1; sequence++)
+  {
+    if (!correlate_entry (sequence) || !correlate_entry (sequence)->hostRequest) continue;
+    entry = *correlate_entry (sequence);
+
+    host = (entry.hostReply - entry.hostRequest) / CYCLES_PER_US;
+    monitor = (entry.monitorEnd - entry.monitorStart) / CYCLES_PER_US;
+    chprintf (chp, "%8u     %02x ", entry.sequence, entry.opcode);
+
+    if (entry.flags & CORRELATE_DELIVERED) chprintf (chp, "%10u ", host);
+    else chprintf (chp, "%10s ", "-");
+
+    if (!(entry.flags & CORRELATE_MONITOR))
+    { /* answered from the reply cache, or still queued */
+      chprintf (chp, "%10s %10s ", (entry.flags & CORRELATE_DELIVERED) ? "cached" : "-", "-");
+    }
+    else if (entry.flags & CORRELATE_DELIVERED) chprintf (chp, "%10u %10d ", monitor, (int32_t)(host - monitor));
+    else chprintf (chp, "%10u %10s ", monitor, "-");
+
+    chprintf (chp, "%5u%s%s%s\r\n", entry.nulls,
+              (entry.flags & CORRELATE_FAILED) ? " failed" : "",
+              (entry.flags & CORRELATE_TIMEOUT) ? " timeout" : "",
+              (entry.flags & CORRELATE_PROXY) ? " (proxy)" : "");
+  }
+  chprintf (chp, "host timeouts %u, caused by the proxy %u\r\n", timeouts, proxyTimeouts);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef CORRELATE_H
+#define CORRELATE_H
+
+/* Most recent proxied transactions kept, must be a power of two */
+#define CORRELATE_DEPTH 16
+
+/* Host-side request of upstream sequence number 'sequence', first attempt started at 'start' */
+void correlate_request (uint32_t sequence, uint8_t opcode, int reply, rtcnt_t start);
+
+/* The upstream worker talked to the monitor for the request */
+void correlate_monitor (uint32_t sequence, rtcnt_t start, rtcnt_t end, int status);
+
+/* The host read the reply, or got a null message instead */
+void correlate_reply (uint32_t sequence);
+void correlate_null (uint32_t sequence);
+
+void correlate_reset (void);
+void correlate_print (BaseSequentialStream *chp);
+
+#endif // CORRELATE_H
@@ -20,6 +20,13 @@
 #include "bbi2c.h"
 #include "debug.h"
 #include "ddcci.h"
+#include "ddcciparse.h"
+#include "opcodes.h"
+#include "upstream.h"
+#include "port.h"
+#include "log.h"
+#include "stats.h"
+#include "latency.h"
 
 #include "shell.h"
 #include "chprintf.h"
@@ -34,202 +41,277 @@
 #define DEFAULT_DDCCI_LENGTH 0x80
 #define DDCCI_RECEIVE_INITIAL_CHK 0x51
 
-#define EDID_LENGTH 128
-
 void BBI2C_Ack (BBI2C_t *dev);
 
-/* Writing a ddc/ci command to the slave */
-int ddcci_write_slave(uint8_t *stream, uint8_t len) /* stream = array with message, len = length of sent array */
-{ /* array typically beginning by 6E */
+/*
+ * Frames in flight between the host and the monitor side. A frame is
+ * passed on by reference, the proxy thread, the request queue and the
+ * latest request of a host each hold one; the last holder returns it.
+ */
+static uint8_t frames[DDCCI_FRAMES][DDCCI_FRAME_MAX] __attribute__((aligned(4)));
+static uint8_t frameRefs[DDCCI_FRAMES];
+static MEMORYPOOL_DECL(framePool, DDCCI_FRAME_MAX, NULL);
+
+void ddcci_init (void)
+{
+  chPoolLoadArray (&framePool, frames, DDCCI_FRAMES);
+}
+
+static uint8_t ddcci_frame_index (uint8_t *frame)
+{
+  return (frame - frames[0]) / DDCCI_FRAME_MAX;
+}
+
+/* a DDCCI_FRAME_MAX buffer held once, NULL if all are in flight */
+uint8_t * ddcci_frame_alloc (void)
+{
+  uint8_t *frame = chPoolAlloc (&framePool);
+
+  if (frame) frameRefs[ddcci_frame_index (frame)] = 1;
+  return frame;
+}
+
+/* one more holder of 'frame', each one calls ddcci_frame_free when done */
+void ddcci_frame_ref (uint8_t *frame)
+{
+  chSysLock ();
+  frameRefs[ddcci_frame_index (frame)]++;
+  chSysUnlock ();
+}
+
+void ddcci_frame_free (uint8_t *frame)
+{
+  chSysLock ();
+  if (--frameRefs[ddcci_frame_index (frame)] == 0) chPoolFreeI (&framePool, frame);
+  chSysUnlock ();
+}
+
+/* append the checksum to a frame built from scratch */
+void ddcci_frame_seal (uint8_t *frame)
+{
+  frame[ddcci_frame_length (frame)] = checksum (1, frame, ddcci_frame_length (frame));
+}
+
+/* change one payload byte of a sealed frame, the checksum follows without another pass */
+void ddcci_frame_set (uint8_t *frame, uint8_t index, uint8_t value)
+{
+  frame[ddcci_frame_length (frame)] ^= frame[index] ^ value;
+  frame[index] = value;
+}
+
+/* give a slow monitor time after each byte of its reply */
+static void ddcci_byte_gap (port_t *port)
+{
+  if (port->timing.byte_gap_us) chThdSleepMicroseconds (port->timing.byte_gap_us);
+}
+
+/* Writing a sealed ddc/ci frame to the slave, as received from the host or built with ddcci_frame_seal */
+int ddcci_write_slave(port_t *port, uint8_t *frame) /* frame typically beginning by 6E */
+{
     uint8_t i, ack;
-    uint8_t send = 1;
+    uint8_t len = ddcci_frame_length (frame) + 1; /* the checksum is part of the frame */
 
-    BBI2C_t dev;
-    BBI2C_Init (&dev, GPIOC, 4, GPIOC, 5, 50000, BBI2C_MODE_MASTER);
-    BBI2C_Start (&dev);
+    BBI2C_t *dev = port_monitor_bus (port, port->timing.write_frequency);
+    BBI2C_Start (dev);
 
     for(i = 0; i < len; i++)
     {
-      ack = BBI2C_Send_Byte (&dev, stream[i]);
+      ack = BBI2C_Send_Byte (dev, frame[i]);
       if(!ack) /* abort when a NACK was is encountered */
       {
-        BBI2C_Stop (&dev);
+        if (!dev->error) stats_inc (&port->stats_monitor, STATS_NACK);
+        BBI2C_Stop (dev);
         return -1;
       }
     }
 
-    ack = BBI2C_Send_Byte (&dev, checksum(send, stream, len)); /* send the checksum for the msg */
-    if(!ack)
-    {
-      BBI2C_Stop (&dev);
-      return -1;
-    }
-
-    BBI2C_Stop (&dev);
+    BBI2C_Stop (dev);
+    stats_inc (&port->stats_monitor, STATS_REQUEST);
     return 0;
 }
 
-/* fakeChk is set to 1 for the first transmission to have more time */
-int ddcci_write_master(uint8_t *stream, uint8_t len, uint8_t fakeChk) /* len = length of whole array */
+/* sending a complete frame, checksum included, to the master reading at 6F */
+int ddcci_write_master(port_t *port, uint8_t *stream, uint8_t len) /* len = length of whole array */
 {
-  uint8_t i, ack, chk;
-  BBI2C_t dev;
-  BBI2C_Init (&dev, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_SLAVE);
+  uint8_t i;
+  int ack = 0;
 
   for(i = 0; i < len; i++)
   {
-    ack = BBI2C_Send_Byte_To_Master (&dev, stream[i]); /* sending the ddc/ci string */
+    ack = BBI2C_Send_Byte_To_Master (&port->host, stream[i]); /* sending the ddc/ci string */
     if (ack == 0)
     {
       continue;
     }
-    else return -1;
+    else if (ack == 1 && i == len - 1) break; /* master NACKs the last byte */
+    else
+    { /* timeouts are counted by the bus code */
+      if (ack == 1) stats_inc (&port->stats_host, STATS_NACK);
+      else if (ack == BBI2C_STOP || ack == BBI2C_START) stats_inc (&port->stats_host, STATS_ABORTED);
+      return -1;
+    }
   }
-  chk = checksum (0, stream, len);
 
-  chprintf(&SDU1, "Sent to master:");
-  for(i = 0; i < len; i++)
-  {
-    chprintf(&SDU1, "%02x ", stream[i]);
-  }
+  log_reply_sent (stream, len);
 
-  //chprintf(&SDU1, "write: calculated chk: %02x \r\n", chk);
-  //if(fakeChk) chk = 0x00;
-  //ack = BBI2C_Send_Byte_To_Master (&dev, chk);
   if(ack == 1) return 0;
   else return 1;
 
 }
 
 /* reading the answer of the slave after a request */
-int ddcci_read_slave(uint8_t *result) /* writing into result array */
+int ddcci_read_slave(port_t *port, uint8_t *result) /* writing into result array */
 {
+  rtcnt_t start = chSysGetRealtimeCounterX();
+  int status;
 
-  chThdSleepMilliseconds (40);
-  BBI2C_t dev;
-  BBI2C_Init (&dev, GPIOC, 4, GPIOC, 5, 10000, BBI2C_MODE_MASTER);
-  BBI2C_Start (&dev);
+  chThdSleepMilliseconds (port->timing.reply_delay_ms);
+  status = ddcci_read_reply (port, result);
+  if (status == 0 && !checkNullMessage (result[1]))
+  {
+    latency_record (LATENCY_MONITOR, result[2], start);
+  }
+  return status;
+}
 
-  //uint8_t result[128];
-  uint8_t i, ack;
-  uint8_t msg_length = 0;
-  uint8_t chk;
+/* count a frame the parser refused */
+static void ddcci_parse_failed (stats_t *stats, ddcci_parser_t *parser, ddcci_parse_status_t status)
+{
+  switch (status)
+  {
+    case DDCCI_PARSE_BAD_LENGTH:
+      LOG_EVENT (LOG_INVALID_LENGTH, parser->frame[parser->count - 1], 0);
+      stats_inc (stats, STATS_FRAME);
+      break;
+    case DDCCI_PARSE_BAD_OPCODE:
+      LOG_EVENT (LOG_INVALID_OPCODE, parser->frame[parser->count - 1], 0);
+      stats_inc (stats, STATS_OPCODE);
+      break;
+    case DDCCI_PARSE_BAD_CHECKSUM:
+      stats_inc (stats, STATS_CHECKSUM);
+      break;
+    default:
+      stats_inc (stats, STATS_FRAME);
+      break;
+  }
+}
+
+/* reading the answer of the slave right away, a busy slave answers with a null message */
+int ddcci_read_reply(port_t *port, uint8_t *result)
+{
+  BBI2C_t *dev = port_monitor_bus (port, port->timing.read_frequency);
+  BBI2C_Start (dev);
+
+  ddcci_parser_t parser;
+  ddcci_parse_status_t status;
+  uint8_t data, ack;
 
   /* start transmission by sending '6F' */
-  ack = BBI2C_Send_Byte (&dev, DEFAULT_DDCCI_R_ADDR);
+  ack = BBI2C_Send_Byte (dev, DEFAULT_DDCCI_R_ADDR);
   if(!ack)
   {
-     chprintf(&SDU1, "no ack on 6f while reading \r\n");
+     if (dev->error) return -1; /* the bus was recovered from a timeout */
+     stats_inc (&port->stats_monitor, STATS_NACK);
+     LOG_EVENT (LOG_NO_ACK_READ_ADDRESS, 0, 0);
      return -1;
   }
-  chThdSleepMicroseconds(5);
-
-  BBI2C_Recv_Byte (&dev, &result[0]);
-  BBI2C_Ack (&dev);
-  chThdSleepMicroseconds(5);
-
-  BBI2C_Recv_Byte (&dev, &result[1]);
-  BBI2C_Ack (&dev);
-  msg_length = result[1] & 0x7F; /* determining length of the answer, all but first bit */
-  chThdSleepMicroseconds(5);
+  ddcci_byte_gap (port);
 
-  if(checkNullMessage (result[1])) /* Null message */
+  /* the checksum byte or the first bad one is NACKed, which ends the read */
+  ddcci_parse_init (&parser, DDCCI_PARSE_REPLY, result, ddcci_known_reply);
+  for (;;)
   {
-    msg_length = 0;
-    chprintf(&SDU1, "nullmessage from monitor\r\n");
+    BBI2C_Recv_Byte (dev, &data);
+    status = ddcci_parse_byte (&parser, data);
+    if (status != DDCCI_PARSE_MORE) break;
+    BBI2C_Ack (dev);
+    if (dev->error) return -1; /* the bus was recovered from a timeout */
+    ddcci_byte_gap (port);
   }
-  else if (msg_length > 35)/* length only 3-35 as defined in vesa ddc/di doc */
+  BBI2C_NACK (dev);
+  BBI2C_Stop (dev);
+  if (dev->error) return -1;
+
+  if (status != DDCCI_PARSE_DONE)
   {
-    chprintf(&SDU1, "invalid message length, got %02x \r\n", result[1]);
-    BBI2C_ACK (&dev);
-    BBI2C_Stop (&dev);
+    ddcci_parse_failed (&port->stats_monitor, &parser, status);
     return -1;
   }
-  else /* Not a null message and valid fragment length */
-  {
-    chprintf(&SDU1, "length of ddc/ci message: %d \r\n", msg_length);
-    for(i = 0; i < msg_length; i++) /* receiving bytes 'msg_length' times */
-    {
-      BBI2C_Recv_Byte (&dev, &result[i+2]);
-      BBI2C_Ack (&dev);
-      chThdSleepMicroseconds(5);
-    }
-  }
-
-  BBI2C_Recv_Byte (&dev, &result[msg_length+2]); /* CHK received separately, must be NACKED and stopped afterwards */
-  BBI2C_NACK (&dev);
-  BBI2C_Stop (&dev);
 
-  /* checking the checksum here */
-  chk = checksum(0, result, (msg_length+1));
-  if(chk != result[msg_length+2]) return -1;
-  chprintf(&SDU1, "calculated chksum %02x\r\n", chk);
-
-  for(i = 0; i < (msg_length+3); i++)
+  if(checkNullMessage (result[1])) /* Null message */
   {
-    chprintf(&SDU1, "%02x ", result[i]);
+    stats_inc (&port->stats_monitor, STATS_NULL_MESSAGE);
+    LOG_EVENT (LOG_NULL_MESSAGE, 0, 0);
+    return 0;
   }
-  chprintf(&SDU1, "\r\n");
+  stats_inc (&port->stats_monitor, STATS_REPLY);
+  log_reply_received (result, parser.count);
   return 0;
 }
 
-/* reading the master by using the received length len */
-uint8_t * ddcci_read_master (BBI2C_t *dev, uint8_t len)
+/*
+ * Reading the rest of a request from the master, address, source and length
+ * 'len' are already received. A bad length or opcode stops the transfer
+ * right there: its byte was ACKed already, the next one is left unanswered
+ * and the master sees a NACK.
+ */
+int ddcci_read_master (port_t *port, uint8_t len, uint8_t *result)
 {
-  uint8_t data, i, chk, fragment_length;
-  static uint8_t result[128];
-  result[0] = 0x6E;
-  result[1] = 0x51;
-  result[2] = len;
+  ddcci_parser_t parser;
+  ddcci_parse_status_t status;
+  uint8_t data;
 
-  fragment_length = len & 0x0F; /* length are last four bytes */
+  ddcci_parse_init (&parser, DDCCI_PARSE_REQUEST, result, ddcci_known_request);
+  ddcci_parse_byte (&parser, DEFAULT_DDCCI_ADDR);
+  ddcci_parse_byte (&parser, DDCCI_RECEIVE_INITIAL_CHK);
+  status = ddcci_parse_byte (&parser, len);
 
-  for(i = 0; i < fragment_length; i++)
+  while (status == DDCCI_PARSE_MORE)
   {
-    data = BBI2C_Get_Byte (dev);
-    result[i+3] = data; /* +3 offset because of 0x6E, 0x51, 0x8X */
+    if (BBI2C_Receive_Byte (&port->host, &data) < 0)
+    {
+      stats_inc (&port->stats_host, STATS_FRAME);
+      return -1; /* the host stopped or stalled mid-frame */
+    }
+    status = ddcci_parse_byte (&parser, data);
   }
 
-  data = BBI2C_Get_Byte (dev);
-  chk = checksum (1, result, fragment_length+3);
-  if(chk != data)
+  if (status != DDCCI_PARSE_DONE)
   {
-     result[1]=0xFF; /* received invalid checksum */
+    ddcci_parse_failed (&port->stats_host, &parser, status);
+    return -1;
   }
-  result[fragment_length+3] = chk;
-
-  return result;
+  return 0;
 }
 
-/* reading the edid from the slave */
-uint8_t * read_edid()
+/* reading the edid from the slave into 'edid', which starts with 0xFF on failure */
+int read_edid(port_t *port, uint8_t *edid)
 {
 
   uint8_t ack, k;
-  static uint8_t edid[128];
   uint8_t retry = 3;
   uint8_t cycle = 1;
 
-  BBI2C_t dev;
-  BBI2C_Init (&dev, GPIOC, 4, GPIOC, 5, 50000, BBI2C_MODE_MASTER);
+  BBI2C_t *dev = port_monitor_bus (port, 50000);
 
   do {
-    BBI2C_Start (&dev);
-    ack = BBI2C_Send_Byte (&dev, DEFAULT_EDID_R_ADDR); /* Addresses A1 to request EDID */
+    BBI2C_Start (dev);
+    ack = BBI2C_Send_Byte (dev, DEFAULT_EDID_R_ADDR); /* Addresses A1 to request EDID */
     chThdSleepMicroseconds(5);
     if(ack)
   	{
   		for(k = 0; k < 128; k++)
   		{
-  			BBI2C_Recv_Byte (&dev, &edid[k]);
-        if (k < 7) BBI2C_Ack (&dev);
+  			BBI2C_Recv_Byte (dev, &edid[k]);
+        if (dev->error) break; /* the bus was recovered, start over */
+        if (k < 7) BBI2C_Ack (dev);
         else if(k > 6 && edid[k-7]==0x00 && edid[k]==0x00 && edid[k-5]==0xFF && edid[k-4]==0xFF && edid[k-3]==0xFF
         && edid[k-2]==0xFF && edid[k-1]==0xFF && edid[k-6]==0xFF)
         { /* to ensure that the EDID is in the right format, the header must be found
               in order to store the subsequent bytes in the right order */
-            chprintf(&SDU1, "found header!\r\n");
-            BBI2C_NACK (&dev);
-            BBI2C_Stop (&dev); /* transmission gets interrupted */
+            LOG_EVENT (LOG_EDID_HEADER_FOUND, 0, 0);
+            BBI2C_NACK (dev);
+            BBI2C_Stop (dev); /* transmission gets interrupted */
             edid[0] = 0x00;
             edid[7] = 0x00;
             edid[1] = 0xFF;
@@ -239,69 +321,74 @@ uint8_t * read_edid()
             edid[5] = 0xFF;
             edid[6] = 0xFF;
             k=7;
-            BBI2C_Start (&dev); /* continue at correct state of sda */
-            BBI2C_Send_Byte (&dev, DEFAULT_EDID_R_ADDR);
+            BBI2C_Start (dev); /* continue at correct state of sda */
+            BBI2C_Send_Byte (dev, DEFAULT_EDID_R_ADDR);
         }
         else if (k==127 && edid[0]==0x00 && edid[7]==0x00 && edid[1]==0xFF && edid[2]==0xFF && edid[3]==0xFF
         && edid[4]==0xFF && edid[5]==0xFF && edid[6]==0xFF)
         { /* edid correctly received */
-          BBI2C_NACK (&dev);
-          BBI2C_Stop (&dev);
-          return edid;
+          BBI2C_NACK (dev);
+          BBI2C_Stop (dev);
+          return 0;
         }
-        else if (k < 127) BBI2C_Ack (&dev); /* ACK every byte */
+        else if (k < 127) BBI2C_Ack (dev); /* ACK every byte */
         else /* if header was not found yet at last byte */
         {
           if(cycle)
           { /* restart request in order to get edid => cyclic */
-            BBI2C_NACK (&dev);
-            BBI2C_Stop (&dev);
-            BBI2C_Start (&dev);
-            BBI2C_Send_Byte (&dev, DEFAULT_EDID_R_ADDR);
+            BBI2C_NACK (dev);
+            BBI2C_Stop (dev);
+            BBI2C_Start (dev);
+            BBI2C_Send_Byte (dev, DEFAULT_EDID_R_ADDR);
             k = 0;
             cycle = 0;
           }
           else
           { /* the second cycle of reading 0-127 did not succeed */
             edid[0] = 0xFF;
-            return edid;
+            return -1;
           }
         }
   		}
+      retry--; /* only reached after a timeout */
   	}
   	else
   	{
-  		BBI2C_NACK(&dev);
-  		BBI2C_Stop(&dev);
+  		BBI2C_NACK(dev);
+  		BBI2C_Stop(dev);
+      if (!dev->error) stats_inc (&port->stats_monitor, STATS_NACK);
       retry--;
   	}
   } while(retry);
 
   edid[0] = 0xFF; /* edid was not captured */
-  return edid;
+  return -1;
 }
 
 /* sending the whole EDID to the master */
-int write_edid (BBI2C_t *i2cdev01, uint8_t *edid)
+int write_edid (port_t *port, uint8_t *edid)
 {
   uint8_t i, ack;
+  rtcnt_t start = chSysGetRealtimeCounterX(); /* the host has just addressed 0xA1 */
 
-  chprintf(&SDU1, "sending edid\r\n");
+  LOG_EVENT (LOG_EDID_SENDING, 0, 0);
 
   for (i = 0; i < EDID_LENGTH; i++)
   { /* sending 128 times */
-    ack = BBI2C_Send_Byte_To_Master (i2cdev01, edid[i]);
+    ack = BBI2C_Send_Byte_To_Master (&port->host, edid[i]);
       if (ack == 0) continue;
       else if (i == 127)
       {
-        if (ack == 1) return 0; /* last byte must be NACKed */
+        if (ack == 1) break; /* last byte must be NACKed */
       }
       else
       {
-        chprintf(&SDU1, "NACK on %02x \r\n", edid[i]);
+        stats_inc (&port->stats_host, STATS_NACK);
+        LOG_EVENT (LOG_EDID_NACK, edid[i], 0);
         return -1;
       }
     }
+  latency_record (LATENCY_EDID, 0xA1, start);
   return 0;
 }
 
@@ -334,3 +421,95 @@ uint8_t checkNullMessage (uint8_t val)
   if (val == 0x80) return 1;
   else return 0;
 }
+
+/* answering a read of the master with "no reply ready yet", the master retries later */
+int ddcci_write_null_message (port_t *port)
+{
+  uint8_t nullMessage[DDCCI_NULL_MESSAGE_LENGTH] = {DEFAULT_DDCCI_ADDR, 0x80, 0x00};
+
+  nullMessage[2] = checksum (0, nullMessage, 1); /* 0x50 ^ 0x6E ^ 0x80 = 0xBE */
+  return ddcci_write_master (port, nullMessage, DDCCI_NULL_MESSAGE_LENGTH);
+}
+
+/* a capabilities reply with the fragment at 'offset': opcode, offset echoed, then up to 32 bytes */
+static uint8_t ddcci_capabilities_reply (uint8_t *reply, uint16_t offset)
+{
+  return !checkNullMessage (reply[1]) && (reply[1] & 0x7F) >= 3 &&
+         reply[2] == DDCCI_OP_CAPABILITIES_REPLY && ((reply[3] << 8) | reply[4]) == offset;
+}
+
+/* reading the complete capabilities string fragment by fragment, returns its length */
+int ddcci_read_capabilities (port_t *port, uint8_t *caps, uint16_t size)
+{
+  uint8_t request[7] = {DEFAULT_DDCCI_ADDR, 0x51, 0x83, 0xF3, 0x00, 0x00};
+  uint8_t reply[DDCCI_FRAME_MAX];
+  uint16_t offset = 0;
+  uint8_t i, fragment, retry;
+
+  ddcci_frame_seal (request);
+  for (;;)
+  {
+    ddcci_frame_set (request, 4, offset >> 8);
+    ddcci_frame_set (request, 5, offset & 0xFF);
+
+    for (retry = 0; retry < 5; retry++)
+    {
+      if (ddcci_write_slave (port, request) == 0 && ddcci_read_slave (port, reply) == 0 &&
+          ddcci_capabilities_reply (reply, offset)) break;
+    }
+    if (retry == 5) return -1;
+
+    fragment = (reply[1] & 0x7F) - 3; /* without opcode and offset */
+    if (fragment == 0) return offset; /* empty fragment terminates the string */
+
+    for (i = 0; i < fragment && offset < size; i++)
+    {
+      caps[offset++] = reply[i+5];
+    }
+    if (offset == size) return offset;
+  }
+}
+
+static int hexdigit (uint8_t c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* collecting the codes of the vcp(...) section into a 256 bit map, returns their number */
+int ddcci_capabilities_vcp (uint8_t *caps, uint16_t len, uint8_t *supported)
+{
+  uint16_t i;
+  uint8_t depth = 0;
+  int count = 0;
+  int high, low;
+
+  for (i = 0; i < 32; i++) supported[i] = 0;
+
+  for (i = 0; i + 4 <= len; i++)
+  { /* 'vcp(' as a whole token, not the tail of e.g. 'mvcp(' */
+    if (caps[i] == 'v' && caps[i+1] == 'c' && caps[i+2] == 'p' && caps[i+3] == '(' &&
+        (i == 0 || caps[i-1] == '(' || caps[i-1] == ')' || caps[i-1] == ' ')) break;
+  }
+  if (i + 4 > len) return -1;
+
+  for (i = i + 4, depth = 1; i < len && depth > 0; i++)
+  {
+    if (caps[i] == '(') depth++;
+    else if (caps[i] == ')') depth--;
+    else if (depth == 1 && i + 1 < len)
+    { /* nested lists hold the allowed values, only the top level are codes */
+      high = hexdigit (caps[i]);
+      low  = hexdigit (caps[i+1]);
+      if (high >= 0 && low >= 0)
+      {
+        supported[(high << 4 | low) / 8] |= 1 << ((high << 4 | low) % 8);
+        count++;
+        i++;
+      }
+    }
+  }
+  return count;
+}
@@ -16,12 +16,78 @@
 #ifndef DDCCI_H
 #define DDCCI_H
 
-int ddcci_write_slave (uint8_t *stream, uint8_t len);
-int ddcci_read_slave (uint8_t *result);
-int ddcci_write_master (uint8_t *stream, uint8_t len, uint8_t fakeChk);
-uint8_t * ddcci_read_master (BBI2C_t *dev, uint8_t length);
-uint8_t * read_edid (void);
-int write_edid (BBI2C_t *dev, uint8_t *edid);
+/* Largest DDC/CI frame including address, length and checksum bytes */
+#define DDCCI_FRAME_MAX 40
+
+/* Largest payload, a table write: opcode, table code, offset and 32 data bytes */
+#define DDCCI_PAYLOAD_MAX (DDCCI_FRAME_MAX - 4)
+
+/* Largest reply payload, a table read or capabilities fragment: opcode, offset and 32 data bytes */
+#define DDCCI_REPLY_PAYLOAD_MAX 35
+
+/* Frames in flight at the same time: one being received per port, plus the
+   queued, executing and latest request of every host */
+#define DDCCI_FRAMES 16
+
+/* EDID base block */
+#define EDID_LENGTH 128
+
+/* Null message a display sends while it has no reply ready: 6E 80 BE */
+#define DDCCI_NULL_MESSAGE_LENGTH 3
+
+/* Monitor-side bus timing, the defaults work with the monitors tested so far */
+typedef struct
+{
+    uint32_t write_frequency;  /* Hz, requests to the monitor */
+    uint32_t read_frequency;   /* Hz, replies from the monitor */
+    uint32_t byte_gap_us;      /* pause after every reply byte */
+    uint32_t reply_delay_ms;   /* between a request and reading its reply */
+} ddcci_timing_t;
+
+#define DDCCI_TIMING_DEFAULT {50000, 10000, 5, 40}
+
+/*
+ * Microseconds an uncontended monitor transaction takes at 'timing': a
+ * request of 'bytes' bytes including the address and, if 'reply' is set,
+ * the reply delay and the largest reply read at 6F. Every byte is 9 clocks,
+ * one byte more per transfer covers START, STOP and clock stretching.
+ * tools/bbi2csim checks it against the bus code.
+ */
+static inline uint32_t ddcci_transaction_us (const ddcci_timing_t *timing, uint8_t bytes, uint8_t reply)
+{
+  uint32_t us = (bytes + 1) * 9 * 1000000 / timing->write_frequency;
+
+  if (reply)
+  {
+    us += timing->reply_delay_ms * 1000;
+    us += (DDCCI_REPLY_PAYLOAD_MAX + 5) * (9 * 1000000 / timing->read_frequency + timing->byte_gap_us);
+  }
+  return us;
+}
+
+struct port;
+
+/* monitor side of a port, called with its bus held, see upstream_acquire */
+int ddcci_write_slave (struct port *port, uint8_t *frame);
+int ddcci_read_slave (struct port *port, uint8_t *result);
+int ddcci_read_reply (struct port *port, uint8_t *result);
+int ddcci_read_capabilities (struct port *port, uint8_t *caps, uint16_t size);
+int read_edid (struct port *port, uint8_t *edid);
+
+/* host side of a port, called from its proxy thread */
+int ddcci_write_master (struct port *port, uint8_t *stream, uint8_t len);
+int ddcci_read_master (struct port *port, uint8_t length, uint8_t *frame);
+int write_edid (struct port *port, uint8_t *edid);
+int ddcci_write_null_message (struct port *port);
+
+void ddcci_init (void);
+uint8_t * ddcci_frame_alloc (void);
+void ddcci_frame_ref (uint8_t *frame);
+void ddcci_frame_free (uint8_t *frame);
+void ddcci_frame_seal (uint8_t *frame);
+void ddcci_frame_set (uint8_t *frame, uint8_t index, uint8_t value);
+
+int ddcci_capabilities_vcp (uint8_t *caps, uint16_t len, uint8_t *supported);
 uint8_t checksum (uint8_t send, uint8_t stream[], uint8_t len);
 uint8_t checkNullMessage (uint8_t val);
 
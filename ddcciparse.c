@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "ddcciparse.h"
+
+#define DDCCI_PARSE_DISPLAY 0x6E  /* destination of requests, source of replies */
+#define DDCCI_PARSE_HOST    0x51  /* source of requests */
+#define DDCCI_PARSE_SEED    0x50  /* reply checksums start with the virtual host address */
+
+void ddcci_parse_init (ddcci_parser_t *parser, ddcci_parse_kind_t kind, uint8_t *frame, ddcci_parse_known_t known)
+{
+  parser->frame  = frame;
+  parser->kind   = kind;
+  parser->count  = 0;
+  parser->end    = 0;
+  parser->xor    = (kind == DDCCI_PARSE_REPLY) ? DDCCI_PARSE_SEED : 0;
+  parser->status = DDCCI_PARSE_MORE;
+  parser->known  = known;
+}
+
+ddcci_parse_status_t ddcci_parse_byte (ddcci_parser_t *parser, uint8_t byte)
+{
+  uint8_t header = (parser->kind == DDCCI_PARSE_REQUEST) ? 3 : 2;  /* up to and including the length */
+  uint8_t index = parser->count;
+  uint8_t payload;
+
+  if (parser->status != DDCCI_PARSE_MORE) return parser->status;
+
+  parser->frame[index] = byte;
+  parser->xor ^= byte;
+  parser->count++;
+
+  if (index == 0)
+  {
+    if (byte != DDCCI_PARSE_DISPLAY) parser->status = DDCCI_PARSE_BAD_HEADER;
+  }
+  else if (index < header - 1)
+  {
+    if (byte != DDCCI_PARSE_HOST) parser->status = DDCCI_PARSE_BAD_HEADER;
+  }
+  else if (index == header - 1)
+  { /* only a reply may be empty, the null message of a busy display */
+    payload = byte & 0x7F;
+    if (!(byte & 0x80) ||
+        payload > ((parser->kind == DDCCI_PARSE_REQUEST) ? DDCCI_PAYLOAD_MAX : DDCCI_REPLY_PAYLOAD_MAX) ||
+        (payload == 0 && parser->kind == DDCCI_PARSE_REQUEST))
+    {
+      parser->status = DDCCI_PARSE_BAD_LENGTH;
+    }
+    parser->end = header + payload;
+  }
+  else if (index == parser->end)
+  {
+    parser->status = parser->xor ? DDCCI_PARSE_BAD_CHECKSUM : DDCCI_PARSE_DONE;
+  }
+  else if (index == header)
+  {
+    if (parser->known && !parser->known (byte)) parser->status = DDCCI_PARSE_BAD_OPCODE;
+  }
+
+  return parser->status;
+}
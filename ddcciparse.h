@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef DDCCIPARSE_H
+#define DDCCIPARSE_H
+
+/*
+ * Byte-at-a-time DDC/CI frame parser. Header, length and opcode are
+ * checked as they arrive and the checksum is kept as a running XOR, so a
+ * bus transfer carrying garbage can be cut short at the first bad byte
+ * instead of after the whole frame. Like the I2C decoder it only depends
+ * on <stdint.h>; tools/ddcciparsetest.c checks it on a Linux host.
+ */
+
+#include <stdint.h>
+
+#include "ddcci.h"
+
+/* frame layouts, they differ in the header and the checksum seed */
+typedef enum
+{
+    DDCCI_PARSE_REQUEST,  /* host to display: 6E 51 length payload checksum */
+    DDCCI_PARSE_REPLY     /* display to host, read at 6F: 6E length payload checksum */
+} ddcci_parse_kind_t;
+
+typedef enum
+{
+    DDCCI_PARSE_MORE,          /* byte taken, the frame goes on */
+    DDCCI_PARSE_DONE,          /* checksum matched, the frame is complete */
+    DDCCI_PARSE_BAD_HEADER,    /* unexpected address byte */
+    DDCCI_PARSE_BAD_LENGTH,    /* length flag missing or payload too long for the frame */
+    DDCCI_PARSE_BAD_OPCODE,    /* opcode nobody handles */
+    DDCCI_PARSE_BAD_CHECKSUM
+} ddcci_parse_status_t;
+
+/* nonzero if frames with this opcode are handled, see opcodes.h */
+typedef uint8_t (*ddcci_parse_known_t) (uint8_t opcode);
+
+typedef struct
+{
+    uint8_t  *frame;   /* DDCCI_FRAME_MAX bytes, filled as the bytes arrive */
+    uint8_t  kind;
+    uint8_t  count;    /* bytes taken */
+    uint8_t  end;      /* index of the checksum byte, once the length is known */
+    uint8_t  xor;      /* running checksum, 0 over a complete good frame */
+    uint8_t  status;   /* kept once the frame is complete or rejected */
+    ddcci_parse_known_t known;  /* NULL accepts any opcode */
+} ddcci_parser_t;
+
+void ddcci_parse_init (ddcci_parser_t *parser, ddcci_parse_kind_t kind, uint8_t *frame, ddcci_parse_known_t known);
+
+/* feed the next byte, anything but DDCCI_PARSE_MORE is final and repeated for further bytes */
+ddcci_parse_status_t ddcci_parse_byte (ddcci_parser_t *parser, uint8_t byte);
+
+#endif // DDCCIPARSE_H
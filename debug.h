@@ -3,10 +3,40 @@
 
 #include "chprintf.h"
 
-extern BaseSequentialStream *dbg;
+/*
+ * Compile-time log levels. LOG_LEVEL sets the default, LOG_LEVEL_<MODULE>
+ * overrides it for one module; both are set through UDEFS in the Makefile.
+ * Anything above the configured level compiles to nothing.
+ */
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
 
-#define DEBUG_DEF BaseSequentialStream *dbg;
-#define DEBUG_INIT(stream) { dbg = stream; } while (0);
-#define DEBUG(fmt,...) chprintf (dbg, fmt, #__VA_ARGS__);
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#ifndef LOG_LEVEL_BBI2C
+#define LOG_LEVEL_BBI2C LOG_LEVEL
+#endif
+
+#ifndef LOG_LEVEL_DDCCI
+#define LOG_LEVEL_DDCCI LOG_LEVEL
+#endif
+
+#ifndef LOG_LEVEL_UPSTREAM
+#define LOG_LEVEL_UPSTREAM LOG_LEVEL
+#endif
+
+#ifndef LOG_LEVEL_PROXY
+#define LOG_LEVEL_PROXY LOG_LEVEL
+#endif
+
+#ifndef LOG_LEVEL_ATTACKS
+#define LOG_LEVEL_ATTACKS LOG_LEVEL
+#endif
+
+#define LOG_ENABLED(module, level) (LOG_LEVEL_##module >= LOG_LEVEL_##level)
 
 #endif // DEBUG_H
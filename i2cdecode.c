@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "i2cdecode.h"
+
+void i2c_decode_init (i2c_decoder_t *dec, i2c_transaction_cb done, void *context)
+{
+  memset (dec, 0, sizeof(*dec));
+  dec->lines = I2C_DECODE_SDA | I2C_DECODE_SCL;
+  dec->done = done;
+  dec->context = context;
+}
+
+static void i2c_decode_begin (i2c_decoder_t *dec, uint32_t time, uint8_t restart)
+{
+  i2c_transaction_t *t = &dec->transaction;
+
+  dec->active = 1;
+  dec->bits = 0;
+  dec->shift = 0;
+  dec->bytes = 0;
+  t->start = time;
+  t->flags = restart ? I2C_DECODE_RESTART : 0;
+  t->address = 0;
+  memset (t->nack, 0, sizeof(t->nack));
+}
+
+static void i2c_decode_end (i2c_decoder_t *dec, uint32_t time, uint8_t flags)
+{
+  i2c_transaction_t *t = &dec->transaction;
+
+  if (!dec->active) return;
+  dec->active = 0;
+
+  /* STOP and repeated START come right after the first clock of a byte */
+  if (dec->bits > 1 || dec->bytes == 0) flags |= I2C_DECODE_PARTIAL;
+
+  t->flags |= flags;
+  t->end = time;
+  t->length = dec->bytes > 1 ? dec->bytes - 1 : 0;
+  if (t->length > I2C_DECODE_PAYLOAD_MAX) t->length = I2C_DECODE_PAYLOAD_MAX;
+
+  dec->done (dec->context, t);
+}
+
+/* a byte and its ACK bit were clocked */
+static void i2c_decode_byte (i2c_decoder_t *dec, int nacked)
+{
+  i2c_transaction_t *t = &dec->transaction;
+
+  if (dec->bytes == 0)
+  {
+    t->address = dec->shift >> 1;
+    if (dec->shift & 1) t->flags |= I2C_DECODE_READ;
+  }
+  else if (dec->bytes <= I2C_DECODE_PAYLOAD_MAX)
+  {
+    t->payload[dec->bytes - 1] = dec->shift;
+  }
+  else
+  {
+    t->flags |= I2C_DECODE_TRUNCATED;
+  }
+
+  if (nacked && dec->bytes <= I2C_DECODE_PAYLOAD_MAX) t->nack[dec->bytes / 8] |= 1 << (dec->bytes % 8);
+  if (dec->bytes < 0xFFFF) dec->bytes++;
+}
+
+void i2c_decode_edge (i2c_decoder_t *dec, uint32_t time, uint8_t lines)
+{
+  uint8_t was = dec->lines;
+
+  if (lines == was) return;
+  dec->lines = lines;
+  dec->last = time;
+
+  if ((was & I2C_DECODE_SCL) && (lines & I2C_DECODE_SCL))
+  { /* SDA changed while SCL is high */
+    if (!(lines & I2C_DECODE_SDA))
+    {
+      uint8_t restart = dec->active;
+
+      i2c_decode_end (dec, time, 0);
+      i2c_decode_begin (dec, time, restart);
+    }
+    else i2c_decode_end (dec, time, I2C_DECODE_STOP);
+    return;
+  }
+
+  if (!dec->active)
+  { /* START and the following clock fall may end up in one sample */
+    if (was == (I2C_DECODE_SDA | I2C_DECODE_SCL) && lines == 0) i2c_decode_begin (dec, time, 0);
+    return;
+  }
+
+  if (!(was & I2C_DECODE_SCL) && (lines & I2C_DECODE_SCL))
+  { /* rising SCL, SDA is valid */
+    if (dec->bits < 8)
+    {
+      dec->shift = (dec->shift << 1) | (lines & I2C_DECODE_SDA);
+      dec->bits++;
+    }
+    else
+    {
+      i2c_decode_byte (dec, lines & I2C_DECODE_SDA);
+      dec->bits = 0;
+    }
+  }
+}
+
+void i2c_decode_timeout (i2c_decoder_t *dec, uint32_t time, uint32_t limit)
+{
+  if (dec->active && time - dec->last > limit) i2c_decode_end (dec, dec->last, 0);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef I2CDECODE_H
+#define I2CDECODE_H
+
+/*
+ * Edge-to-transaction decoder for a passively observed I2C bus. It only
+ * depends on <stdint.h>, so recorded edge files can be decoded on a
+ * Linux host with the very same code (tools/edgedecode.c).
+ */
+
+#include <stdint.h>
+
+/* Longest payload kept per transaction, the rest is only counted */
+#define I2C_DECODE_PAYLOAD_MAX 255
+
+/* line levels passed to i2c_decode_edge */
+#define I2C_DECODE_SDA 0x01
+#define I2C_DECODE_SCL 0x02
+
+/* transaction flags */
+#define I2C_DECODE_READ      0x01  /* R/W bit of the address byte */
+#define I2C_DECODE_STOP      0x02  /* ended by STOP, otherwise by repeated START or timeout */
+#define I2C_DECODE_RESTART   0x04  /* began with a repeated START */
+#define I2C_DECODE_TRUNCATED 0x08  /* more than I2C_DECODE_PAYLOAD_MAX bytes */
+#define I2C_DECODE_PARTIAL   0x10  /* ended in the middle of a byte */
+
+typedef struct
+{
+    uint32_t start;    /* time of the START condition */
+    uint32_t end;      /* time of the STOP, repeated START or last edge */
+    uint8_t  flags;
+    uint8_t  address;  /* 7 bit address */
+    uint16_t length;   /* payload bytes after the address, at most I2C_DECODE_PAYLOAD_MAX */
+    uint8_t  payload[I2C_DECODE_PAYLOAD_MAX];
+    uint8_t  nack[(I2C_DECODE_PAYLOAD_MAX + 8) / 8];  /* bit i set: byte i NACKed, byte 0 is the address */
+} i2c_transaction_t;
+
+typedef void (*i2c_transaction_cb) (void *context, const i2c_transaction_t *transaction);
+
+typedef struct
+{
+    uint8_t  lines;   /* last I2C_DECODE_SDA/I2C_DECODE_SCL */
+    uint8_t  bits;    /* bits of the current byte, 8 while its ACK is due */
+    uint8_t  shift;
+    uint8_t  active;  /* inside a transaction */
+    uint16_t bytes;   /* bytes of the transaction including the address */
+    uint32_t last;    /* time of the last edge */
+    i2c_transaction_t transaction;
+    i2c_transaction_cb done;
+    void     *context;
+} i2c_decoder_t;
+
+void i2c_decode_init (i2c_decoder_t *dec, i2c_transaction_cb done, void *context);
+
+/* new line levels at 'time', times are in any unit that increases monotonically modulo 2^32 */
+void i2c_decode_edge (i2c_decoder_t *dec, uint32_t time, uint8_t lines);
+
+/* end a transaction that saw no edge for 'limit' time units */
+void i2c_decode_timeout (i2c_decoder_t *dec, uint32_t time, uint32_t limit);
+
+#endif // I2CDECODE_H
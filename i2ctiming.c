@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "i2ctiming.h"
+
+#define I2C_TIMING_NAME(id, name, stdmin, stdmax, fastmin, fastmax) [id] = name,
+#define I2C_TIMING_LIMITS(id, name, stdmin, stdmax, fastmin, fastmax) [id] = {{stdmin, stdmax}, {fastmin, fastmax}},
+
+const char * const i2c_timing_names[I2C_TIMING_MAX] =
+{
+  I2C_TIMING_PARAMETERS(I2C_TIMING_NAME)
+};
+
+/* [parameter][fast mode][min, max] */
+static const uint32_t limits[I2C_TIMING_MAX][2][2] =
+{
+  I2C_TIMING_PARAMETERS(I2C_TIMING_LIMITS)
+};
+
+void i2c_timing_init (i2c_timing_t *timing, uint8_t lines)
+{
+  memset (timing, 0, sizeof(*timing));
+  timing->lines = lines;
+}
+
+static void i2c_timing_add (i2c_timing_t *timing, i2c_timing_parameter_t parameter, uint32_t value)
+{
+  i2c_timing_stat_t *s = &timing->stat[parameter];
+
+  if (s->count == 0 || value < s->min) s->min = value;
+  if (value > s->max) s->max = value;
+  s->sum += value;
+  s->count++;
+}
+
+/* the master drives the address, written data and the ACK of read data, bit 0 is START */
+static uint8_t i2c_timing_master_bit (const i2c_timing_t *timing, uint8_t byte, uint8_t bit)
+{
+  if (bit == 0) return 1;
+  if (bit == 9) return byte > 0 && timing->read;
+  return byte == 0 || !timing->read;
+}
+
+void i2c_timing_edge (i2c_timing_t *timing, uint32_t time, uint8_t lines)
+{
+  uint8_t changed = timing->lines ^ lines;
+  uint8_t next = (timing->clocks == 9) ? 1 : timing->clocks + 1;  /* clock ending the current low phase */
+  uint8_t nextByte = (timing->clocks == 9) ? timing->byte + 1 : timing->byte;
+  uint8_t master;
+
+  timing->lines = lines;
+
+  if (changed & I2C_DECODE_SCL)
+  {
+    if (!timing->active) return;
+
+    if (!(lines & I2C_DECODE_SCL))
+    {
+      if (timing->started) i2c_timing_add (timing, I2C_TIMING_START_HOLD, time - timing->startTime);
+      else i2c_timing_add (timing, I2C_TIMING_SCL_HIGH, time - timing->sclRise);
+      timing->started = 0;
+      timing->sdaChanged = 0;
+      timing->sclFall = time;
+      return;
+    }
+
+    if (timing->clocks == 9)
+    {
+      i2c_timing_add (timing, I2C_TIMING_BYTE_PAUSE, time - timing->sclFall);
+      timing->clocks = 0;
+      timing->byte++;
+    }
+    else
+    {
+      i2c_timing_add (timing, I2C_TIMING_SCL_LOW, time - timing->sclFall);
+      if (timing->clocks > 0) i2c_timing_add (timing, I2C_TIMING_SCL_PERIOD, time - timing->sclRise);
+    }
+    if (timing->sdaChanged)
+    {
+      master = i2c_timing_master_bit (timing, nextByte, next);
+      i2c_timing_add (timing, master ? I2C_TIMING_MASTER_SETUP : I2C_TIMING_SLAVE_SETUP, time - timing->sdaChange);
+    }
+
+    timing->clocks++;
+    if (timing->byte == 0 && timing->clocks == 8) timing->read = (lines & I2C_DECODE_SDA) ? 1 : 0;
+    timing->sclRise = time;
+    return;
+  }
+
+  if (!(changed & I2C_DECODE_SDA)) return;
+
+  if (lines & I2C_DECODE_SCL)
+  {
+    if (!(lines & I2C_DECODE_SDA))
+    { /* START, a repeated one does not free the bus */
+      if (timing->active) i2c_timing_add (timing, I2C_TIMING_START_SETUP, time - timing->sclRise);
+      else if (timing->stopped) i2c_timing_add (timing, I2C_TIMING_BUS_FREE, time - timing->stopTime);
+      timing->active = 1;
+      timing->started = 1;
+      timing->clocks = 0;
+      timing->byte = 0;
+      timing->read = 0;
+      timing->startTime = time;
+    }
+    else if (timing->active)
+    { /* STOP */
+      i2c_timing_add (timing, I2C_TIMING_STOP_SETUP, time - timing->sclRise);
+      timing->active = 0;
+      timing->stopped = 1;
+      timing->stopTime = time;
+      timing->transactions++;
+    }
+    return;
+  }
+
+  /* data change while SCL is low, a bit handed over between master and slave has no hold time */
+  if (!timing->active) return;
+  if (!timing->sdaChanged)
+  {
+    master = i2c_timing_master_bit (timing, timing->byte, timing->clocks);
+    if (master == i2c_timing_master_bit (timing, nextByte, next))
+    {
+      i2c_timing_add (timing, master ? I2C_TIMING_MASTER_HOLD : I2C_TIMING_SLAVE_HOLD, time - timing->sclFall);
+    }
+  }
+  timing->sdaChanged = 1;
+  timing->sdaChange = time;
+}
+
+void i2c_timing_limits (i2c_timing_parameter_t parameter, uint32_t frequency, uint32_t *min, uint32_t *max)
+{
+  uint8_t fast = frequency > I2C_TIMING_STANDARD_MAX;
+
+  *min = limits[parameter][fast][0];
+  *max = limits[parameter][fast][1];
+}
+
+uint32_t i2c_timing_violations (const i2c_timing_t *timing, uint32_t frequency, uint32_t units)
+{
+  const i2c_timing_stat_t *s;
+  uint32_t min, max, result = 0;
+  uint8_t i;
+
+  for (i = 0; i < I2C_TIMING_MAX; i++)
+  {
+    s = &timing->stat[i];
+    if (s->count == 0) continue;
+    i2c_timing_limits (i, frequency, &min, &max);
+    if ((uint64_t)s->min * 1000 < (uint64_t)min * units) result |= 1 << i;
+    if (max && (uint64_t)s->max * 1000 > (uint64_t)max * units) result |= 1 << i;
+  }
+  return result;
+}
+
+uint32_t i2c_timing_frequency (const i2c_timing_t *timing, uint32_t units)
+{
+  const i2c_timing_stat_t *s = &timing->stat[I2C_TIMING_SCL_PERIOD];
+
+  if (s->count == 0 || s->sum == 0) return 0;
+  return (uint64_t)units * 1000000 * s->count / s->sum;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef I2CTIMING_H
+#define I2CTIMING_H
+
+/*
+ * Timing analysis of an observed I2C bus against the limits of the
+ * I2C specification. Like the decoder it only depends on <stdint.h>,
+ * so the firmware and the host-side simulation (tools/bbi2csim) check
+ * the bus code with the same rules.
+ */
+
+#include <stdint.h>
+
+#include "i2cdecode.h"
+
+/*
+ * Parameters with their standard mode and fast mode limits in ns, 0 for
+ * none. Setup and hold are split by the side driving the data bit, a
+ * hold time is only taken when the same side drives both bits.
+ */
+#define I2C_TIMING_PARAMETERS(X) \
+    X(I2C_TIMING_SCL_PERIOD,   "scl-period",   10000,    0, 2500,   0)  /* rise to rise within a byte */ \
+    X(I2C_TIMING_SCL_HIGH,     "scl-high",      4000,    0,  600,   0)  /* tHIGH */ \
+    X(I2C_TIMING_SCL_LOW,      "scl-low",       4700,    0, 1300,   0)  /* tLOW within a byte */ \
+    X(I2C_TIMING_BYTE_PAUSE,   "byte-pause",    4700,    0, 1300,   0)  /* tLOW after the ACK clock */ \
+    X(I2C_TIMING_START_SETUP,  "start-setup",   4700,    0,  600,   0)  /* tSU;STA of a repeated START */ \
+    X(I2C_TIMING_START_HOLD,   "start-hold",    4000,    0,  600,   0)  /* tHD;STA */ \
+    X(I2C_TIMING_STOP_SETUP,   "stop-setup",    4000,    0,  600,   0)  /* tSU;STO */ \
+    X(I2C_TIMING_BUS_FREE,     "bus-free",      4700,    0, 1300,   0)  /* tBUF */ \
+    X(I2C_TIMING_MASTER_SETUP, "master-setup",   250,    0,  100,   0)  /* tSU;DAT */ \
+    X(I2C_TIMING_MASTER_HOLD,  "master-hold",      0, 3450,    0, 900)  /* tHD;DAT */ \
+    X(I2C_TIMING_SLAVE_SETUP,  "slave-setup",    250,    0,  100,   0) \
+    X(I2C_TIMING_SLAVE_HOLD,   "slave-hold",       0, 3450,    0, 900)
+
+#define I2C_TIMING_PARAMETER_ID(id, name, stdmin, stdmax, fastmin, fastmax) id,
+
+typedef enum
+{
+    I2C_TIMING_PARAMETERS(I2C_TIMING_PARAMETER_ID)
+    I2C_TIMING_MAX
+} i2c_timing_parameter_t;
+
+/* Above this SCL frequency the fast mode limits apply */
+#define I2C_TIMING_STANDARD_MAX 100000
+
+typedef struct
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;  /* bus-free times of many transactions overflow 32 bits */
+    uint32_t count;
+} i2c_timing_stat_t;
+
+typedef struct
+{
+    uint8_t  lines;       /* last I2C_DECODE_SDA/I2C_DECODE_SCL */
+    uint8_t  active;      /* between START and STOP */
+    uint8_t  started;     /* SCL has not fallen since START */
+    uint8_t  stopped;     /* a STOP was seen, bus-free can be measured */
+    uint8_t  clocks;      /* SCL pulses of the current byte, 9 with ACK */
+    uint8_t  byte;        /* 0 is the address byte */
+    uint8_t  read;        /* R/W bit of the address byte */
+    uint8_t  sdaChanged;  /* SDA changed in the current SCL low phase */
+    uint32_t sclRise;
+    uint32_t sclFall;
+    uint32_t sdaChange;
+    uint32_t startTime;
+    uint32_t stopTime;
+    uint32_t transactions;
+    i2c_timing_stat_t stat[I2C_TIMING_MAX];
+} i2c_timing_t;
+
+extern const char * const i2c_timing_names[I2C_TIMING_MAX];
+
+void i2c_timing_init (i2c_timing_t *timing, uint8_t lines);
+
+/* new line levels at 'time', any time unit that increases monotonically modulo 2^32 */
+void i2c_timing_edge (i2c_timing_t *timing, uint32_t time, uint8_t lines);
+
+/* limits in ns of a parameter for a bus clocked at 'frequency' Hz */
+void i2c_timing_limits (i2c_timing_parameter_t parameter, uint32_t frequency, uint32_t *min, uint32_t *max);
+
+/* bit mask of parameters outside the limits, 'units' time units per microsecond */
+uint32_t i2c_timing_violations (const i2c_timing_t *timing, uint32_t frequency, uint32_t units);
+
+/* average SCL frequency in Hz, 0 if no clock was seen */
+uint32_t i2c_timing_frequency (const i2c_timing_t *timing, uint32_t units);
+
+#endif // I2CTIMING_H
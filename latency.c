@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Latency histograms in fixed memory. Recording is a handful of
+ * instructions in a short critical section, so it is cheap enough for
+ * the bus loops; percentiles are only computed when printing.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "latency.h"
+
+#include "chprintf.h"
+
+typedef struct
+{
+  uint8_t  used;
+  uint8_t  kind;
+  uint8_t  opcode;
+  uint32_t count;
+  uint32_t max;  /* microseconds */
+  uint32_t bucket[LATENCY_BUCKETS];
+} latency_hist_t;
+
+static latency_hist_t slots[LATENCY_SLOTS];
+static uint32_t overflow;  /* samples without a free slot */
+
+static const char * const kinds[] = {"host", "monitor", "edid"};
+
+static uint8_t latency_bucket (uint32_t us)
+{
+  uint8_t msb, index;
+
+  if (us < (1 << LATENCY_SUB_BITS)) return us;
+
+  msb = 31 - __builtin_clz (us);
+  index = ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+          ((us >> (msb - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+  return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+/* largest value counted in a bucket */
+static uint32_t latency_bucket_limit (uint8_t index)
+{
+  uint8_t shift;
+
+  if (index < (1 << LATENCY_SUB_BITS)) return index;
+
+  shift = (index >> LATENCY_SUB_BITS) - 1;
+  return ((((1 << LATENCY_SUB_BITS) | (index & ((1 << LATENCY_SUB_BITS) - 1))) + 1) << shift) - 1;
+}
+
+void latency_record (latency_kind_t kind, uint8_t opcode, rtcnt_t start)
+{
+  uint32_t us = (chSysGetRealtimeCounterX() - start) / (STM32_HCLK / 1000000);
+  latency_hist_t *hist = NULL;
+  uint8_t i;
+
+  chSysLock ();
+  for (i = 0; i < LATENCY_SLOTS && slots[i].used; i++)
+  {
+    if (slots[i].kind == kind && slots[i].opcode == opcode)
+    {
+      hist = &slots[i];
+      break;
+    }
+  }
+  if (!hist && i < LATENCY_SLOTS)
+  {
+    hist = &slots[i];
+    hist->used = 1;
+    hist->kind = kind;
+    hist->opcode = opcode;
+  }
+
+  if (hist)
+  {
+    hist->count++;
+    hist->bucket[latency_bucket (us)]++;
+    if (us > hist->max) hist->max = us;
+  }
+  else overflow++;
+  chSysUnlock ();
+}
+
+/* cleared from the end, so the used slots stay in front of the unused ones */
+void latency_reset (void)
+{
+  uint8_t i = LATENCY_SLOTS;
+
+  while (i--)
+  {
+    chSysLock ();
+    memset (&slots[i], 0, sizeof(slots[i]));
+    chSysUnlock ();
+  }
+  overflow = 0;
+}
+
+/* smallest bucket limit below which 'permille' of the samples lie */
+static uint32_t latency_percentile (latency_hist_t *hist, uint16_t permille)
+{
+  uint32_t rank = (hist->count * permille + 999) / 1000;
+  uint32_t seen = 0;
+  uint8_t i;
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += hist->bucket[i];
+    if (seen >= rank) break;
+  }
+  if (i == LATENCY_BUCKETS) return hist->max;
+  return latency_bucket_limit (i) < hist->max ? latency_bucket_limit (i) : hist->max;
+}
+
+void latency_print (BaseSequentialStream *chp)
+{
+  static latency_hist_t copy;
+  uint8_t i;
+
+  chprintf (chp, "%-8s %6s %8s %10s %10s %10s %10s\r\n", "kind", "opcode", "count", "p50/us", "p90/us", "p99/us", "max/us");
+  for (i = 0; i < LATENCY_SLOTS; i++)
+  {
+    chSysLock ();
+    copy = slots[i];
+    chSysUnlock ();
+    if (!copy.used) break;
+
+    chprintf (chp, "%-8s     %02x %8u %10u %10u %10u %10u\r\n", kinds[copy.kind], copy.opcode, copy.count,
+              latency_percentile (&copy, 500), latency_percentile (&copy, 900),
+              latency_percentile (&copy, 990), copy.max);
+  }
+  if (overflow) chprintf (chp, "%u samples without a free histogram\r\n", overflow);
+}
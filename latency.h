@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/* Histograms for distinct kind/opcode pairs, further pairs are not recorded */
+#define LATENCY_SLOTS 16
+
+/*
+ * Log-bucketed microseconds: every power of two is split into
+ * 2^LATENCY_SUB_BITS buckets, so a bucket is at most 25% wide.
+ * Values above the last bucket (~16 s) are counted in it.
+ */
+#define LATENCY_SUB_BITS 2
+#define LATENCY_BUCKETS  92
+
+typedef enum
+{
+    LATENCY_HOST,     /* host request on 0x6E until its reply is available */
+    LATENCY_MONITOR,  /* reading a reply from the monitor, by reply opcode */
+    LATENCY_EDID      /* EDID served to the host after 0xA1 */
+} latency_kind_t;
+
+/* account the time from 'start' (realtime counter) until now */
+void latency_record (latency_kind_t kind, uint8_t opcode, rtcnt_t start);
+void latency_reset (void);
+void latency_print (BaseSequentialStream *chp);
+
+#endif // LATENCY_H
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Deferred logging. Code running in the middle of a bus transaction must
+ * not wait for USB, so it only copies a small binary record into a ring
+ * buffer. A low priority thread formats the records and writes them to
+ * the USB serial line. Writers never block: when the ring is full the
+ * record is counted as dropped.
+ *
+ * The ring follows the bounded queue scheme where each slot carries a
+ * sequence number: writers claim a slot with a compare-and-swap on the
+ * head index, the single reader owns the tail. Several threads may log
+ * concurrently without a lock.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "log.h"
+
+#include "chprintf.h"
+
+typedef struct
+{
+  volatile uint32_t sequence;  /* slot is readable when sequence == position + 1 */
+  uint32_t timestamp;          /* realtime counter, CPU cycles */
+  uint8_t  message;
+  uint8_t  len;                /* 0: a and b in data, otherwise number of bytes */
+  uint8_t  data[LOG_DATA_SIZE];
+} log_record_t;
+
+#define LOG_RECORD_EVENT 0
+
+#define LOG_MESSAGE_FORMAT(id, module, level, format) [id] = LOG_ENABLED(module, level) ? format : NULL,
+
+static const char * const formats[LOG_MAX] =
+{
+  LOG_MESSAGES(LOG_MESSAGE_FORMAT)
+};
+
+static log_record_t ring[LOG_RING_SIZE];
+static uint32_t head;     /* next position to claim, shared by all writers */
+static uint32_t tail;     /* next position to read, owned by the flush thread */
+static uint32_t dropped;
+
+static log_record_t * log_claim (uint32_t *position)
+{
+  log_record_t *record;
+  uint32_t pos = __atomic_load_n (&head, __ATOMIC_RELAXED);
+
+  for (;;)
+  {
+    record = &ring[pos & (LOG_RING_SIZE - 1)];
+    int32_t diff = (int32_t)(__atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE) - pos);
+
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n (&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        *position = pos;
+        return record;
+      }
+      /* lost against another writer, pos now holds the current head */
+    }
+    else if (diff < 0)
+    { /* slot not yet consumed, the ring is full */
+      __atomic_fetch_add (&dropped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    else
+    {
+      pos = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void log_commit (log_record_t *record, uint32_t position)
+{
+  __atomic_store_n (&record->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+void log_event (log_message_t message, uint32_t a, uint32_t b)
+{
+  uint32_t position;
+  log_record_t *record = log_claim (&position);
+  uint8_t i;
+
+  if (!record) return;
+
+  record->timestamp = chSysGetRealtimeCounterX();
+  record->message = message;
+  record->len = LOG_RECORD_EVENT;
+  for (i = 0; i < 4; i++)
+  {
+    record->data[i]   = a >> (8 * i);
+    record->data[i+4] = b >> (8 * i);
+  }
+  log_commit (record, position);
+}
+
+void log_bytes (log_message_t message, const uint8_t *data, uint8_t len)
+{
+  uint32_t position;
+  log_record_t *record;
+  uint8_t i, chunk;
+
+  do
+  {
+    record = log_claim (&position);
+    if (!record) return;
+
+    chunk = (len > LOG_DATA_SIZE) ? LOG_DATA_SIZE : len;
+    record->timestamp = chSysGetRealtimeCounterX();
+    record->message = message;
+    record->len = chunk;
+    for (i = 0; i < chunk; i++)
+    {
+      record->data[i] = data[i];
+    }
+    log_commit (record, position);
+
+    data += chunk;
+    len -= chunk;
+    message = LOG_CONTINUED;
+  } while (len);
+}
+
+uint32_t log_dropped (void)
+{
+  return __atomic_load_n (&dropped, __ATOMIC_RELAXED);
+}
+
+static uint32_t log_word (uint8_t *data)
+{
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void log_format (BaseSequentialStream *chp, log_record_t *record)
+{
+  uint8_t i;
+
+  if (record->message != LOG_CONTINUED)
+  {
+    chprintf (chp, "\r\n[%10u] ", record->timestamp / (STM32_HCLK / 1000000));
+  }
+
+  if (record->len == LOG_RECORD_EVENT)
+  {
+    chprintf (chp, formats[record->message], log_word (&record->data[0]), log_word (&record->data[4]));
+  }
+  else
+  {
+    chprintf (chp, formats[record->message]);
+    for (i = 0; i < record->len; i++)
+    {
+      chprintf (chp, "%02x ", record->data[i]);
+    }
+  }
+}
+
+static THD_WORKING_AREA(logThreadWA, 512);
+static THD_FUNCTION(logThread, arg)
+{
+  BaseSequentialStream *chp = (BaseSequentialStream *)&SDU1;
+  log_record_t *record;
+  uint32_t reported = 0;
+  uint32_t lost;
+
+  (void)arg;
+  chRegSetThreadName("log");
+
+  for (;;)
+  {
+    record = &ring[tail & (LOG_RING_SIZE - 1)];
+    if (__atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE) != tail + 1)
+    { /* empty */
+      lost = log_dropped ();
+      if (lost != reported)
+      {
+        chprintf (chp, "\r\n*** %u log records dropped", lost - reported);
+        reported = lost;
+      }
+      chThdSleepMilliseconds (10);
+      continue;
+    }
+
+    log_format (chp, record);
+    __atomic_store_n (&record->sequence, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    tail++;
+  }
+}
+
+void log_start (void)
+{
+  uint32_t i;
+
+  for (i = 0; i < LOG_RING_SIZE; i++)
+  {
+    ring[i].sequence = i;
+  }
+  chThdCreateStatic (logThreadWA, sizeof(logThreadWA), LOWPRIO, logThread, NULL);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include "debug.h"
+
+/* Number of records in the ring, must be a power of two */
+#define LOG_RING_SIZE 64
+
+/* Payload bytes per record, longer byte dumps continue in further records */
+#define LOG_DATA_SIZE 22
+
+/*
+ * Messages with the module and level they belong to. The format strings
+ * of disabled messages are not part of the image.
+ */
+#define LOG_MESSAGES(X) \
+    X(LOG_CONTINUED,             BBI2C,    ERROR, "") \
+    X(LOG_BUS_RECOVERY,          BBI2C,    ERROR, "bus recovery took %u us, result %d") \
+    X(LOG_SENT_TO_MASTER,        DDCCI,    DEBUG, "Sent to master: ") \
+    X(LOG_NO_ACK_READ_ADDRESS,   DDCCI,    ERROR, "no ack on 6f while reading") \
+    X(LOG_NULL_MESSAGE,          DDCCI,    INFO,  "nullmessage from monitor") \
+    X(LOG_INVALID_LENGTH,        DDCCI,    ERROR, "invalid message length, got %02x") \
+    X(LOG_INVALID_OPCODE,        DDCCI,    ERROR, "invalid opcode %02x, transfer aborted") \
+    X(LOG_MESSAGE_LENGTH,        DDCCI,    DEBUG, "length of ddc/ci message: %d") \
+    X(LOG_CHECKSUM,              DDCCI,    DEBUG, "calculated chksum %02x") \
+    X(LOG_RECEIVED_FROM_SLAVE,   DDCCI,    DEBUG, "Received from slave: ") \
+    X(LOG_EDID_HEADER_FOUND,     DDCCI,    INFO,  "found header!") \
+    X(LOG_EDID_SENDING,          DDCCI,    DEBUG, "sending edid") \
+    X(LOG_EDID_NACK,             DDCCI,    ERROR, "NACK on %02x") \
+    X(LOG_UPSTREAM_WRITE_FAILED, UPSTREAM, ERROR, "ddcciwrite failed") \
+    X(LOG_UPSTREAM_READ_FAILED,  UPSTREAM, ERROR, "failed reading ddc/ci, retrying") \
+    X(LOG_UPSTREAM_UNEXPECTED,   UPSTREAM, ERROR, "unexpected reply %02x to %s") \
+    X(LOG_UPSTREAM_QUEUE_FULL,   UPSTREAM, ERROR, "upstream queue full, dropped %s") \
+    X(LOG_PROXY_INVALID_REQUEST, PROXY,    ERROR, "got invalid data for ddc/ci") \
+    X(LOG_PROXY_UNSUPPORTED,     PROXY,    INFO,  "unsupported ddc/ci opcode %02x") \
+    X(LOG_PROXY_REPLY,           PROXY,    DEBUG, "reply sent to host, result %d") \
+    X(LOG_PROXY_NULL_NACK,       PROXY,    ERROR, "no ack on null message") \
+    X(LOG_PROXY_EDID_SENT,       PROXY,    INFO,  "Sent EDID to Host") \
+    X(LOG_PROXY_EDID_FAILED,     PROXY,    ERROR, "Writing EDID to Host failed") \
+    X(LOG_PROXY_PROFILE,         PROXY,    INFO,  "monitor profile %04x:%04x loaded") \
+    X(LOG_ATTACK_NAME_REPLACED,  ATTACKS,  INFO,  "display name descriptor at %u replaced") \
+    X(LOG_ATTACK_NAME_MISSING,   ATTACKS,  INFO,  "no display name descriptor") \
+    X(LOG_ATTACK_FUZZED,         ATTACKS,  INFO,  "changed byte %u to %02x") \
+    X(LOG_ATTACK_EDID,           ATTACKS,  DEBUG, "faked edid: ")
+
+#define LOG_MESSAGE_ID(id, module, level, format) id,
+#define LOG_MESSAGE_ENABLED(id, module, level, format) id##_ENABLED = LOG_ENABLED(module, level),
+
+typedef enum
+{
+    LOG_MESSAGES(LOG_MESSAGE_ID)
+    LOG_MAX
+} log_message_t;
+
+enum
+{
+    LOG_MESSAGES(LOG_MESSAGE_ENABLED)
+};
+
+/* Log calls for bus code, the arguments are not evaluated when disabled */
+#define LOG_EVENT(message, a, b) \
+    do { if (message##_ENABLED) log_event (message, a, b); } while (0)
+#define LOG_BYTES(message, data, len) \
+    do { if (message##_ENABLED) log_bytes (message, data, len); } while (0)
+
+void log_start (void);
+void log_event (log_message_t message, uint32_t a, uint32_t b);
+void log_bytes (log_message_t message, const uint8_t *data, uint8_t len);
+uint32_t log_dropped (void);
+
+/*
+ * Log calls per DDC/CI reply, for a frame read from the monitor and for a
+ * frame sent on to the host. The proxy path and the logcost measurements
+ * (shell command and tools/logbench) all go through these.
+ */
+static inline void log_reply_received (const uint8_t *frame, uint8_t len)
+{
+  LOG_EVENT (LOG_MESSAGE_LENGTH, frame[1] & 0x7F, 0);
+  LOG_EVENT (LOG_CHECKSUM, frame[len - 1], 0);
+  LOG_BYTES (LOG_RECEIVED_FROM_SLAVE, frame, len);
+}
+
+static inline void log_reply_sent (const uint8_t *frame, uint8_t len)
+{
+  LOG_BYTES (LOG_SENT_TO_MASTER, frame, len);
+}
+
+#endif // LOG_H
@@ -14,6 +14,8 @@
     limitations under the License.
 */
 
+#include <string.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "usbcfg.h"
@@ -21,6 +23,19 @@
 #include "debug.h"
 #include "ddcci.h"
 #include "attacks.h"
+#include "opcodes.h"
+#include "upstream.h"
+#include "port.h"
+#include "proxy.h"
+#include "mirror.h"
+#include "log.h"
+#include "stats.h"
+#include "latency.h"
+#include "trace.h"
+#include "sniffer.h"
+#include "correlate.h"
+#include "timing.h"
+#include "profile.h"
 
 #include "shell.h"
 #include "chprintf.h"
@@ -34,24 +49,13 @@
 
 #define SHELL_WA_SIZE   THD_WORKING_AREA_SIZE(2048)
 
-#define MASTER_EDID_REQUEST 0xA1
-#define MASTER_WRITE_REQUEST 0xA0
-#define MASTER_DDCCI_REQUEST 0x6E
-#define MASTER_DDCCI_ANSWER_REQUEST 0x6F
-#define MASTER_DDCCI_SOURCE_ADDRESS 0x51
-#define MASTER_DDCCI_CAPABILITY_REQUEST 0xF3
-
-#define MASTER_DDCCI_VCP_REQUEST 0x01
-#define MASTER_SET_CTRL_ADDRESS 0x03
-#define MASTER_SAVE_SETTINGS 0x0C
-
+/* vcpscan: adaptive pause between bus operations and per-code time limit */
+#define VCPSCAN_GAP_MIN_MS 1
+#define VCPSCAN_GAP_MAX_MS 50
+#define VCPSCAN_TIMEOUT_MS 200
+#define VCPSCAN_CAPS_SIZE  1024
 
 
-DEBUG_DEF
-
-uint8_t capAnswer[38];
-uint8_t vcpAnswer[13];
-uint8_t capRequest[6] = {0x6E, 0x51, 0x83, 0xF3, 0x00, 0x00};
 uint8_t dummyEDID[128] = /* Dummy EDID with wrong checksum */
 {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -69,279 +73,43 @@ uint8_t dummyEDID[128] = /* Dummy EDID with wrong checksum */
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
-uint8_t dummyCap[6] = /* capabilities for saving time for the real request */
-{0x6E, 0x83, 0xE3, 0x00, 0x00, 0x00};
-uint8_t dummyVCP[11]= /* dummy vcp features for saving time */
-{0x6E, 0x88, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00};
-
-
-uint8_t * ddcRequest; /* cached EDID */
-uint8_t * savedEDID;
 
 
 void Drive_SDA (BBI2C_t *dev, int sda);
 void BBI2C_Ack (BBI2C_t *dev);
-int atoi (const char *string);
-void Drive_SCL (BBI2C_t *dev, int scl);
-
-/* Module for the proxy functionality */
+int atoi (const char *string);
+long strtol (const char *string, char **end, int base);
+void Drive_SCL (BBI2C_t *dev, int scl);
+
+/* Proxy on all ports, runs in the background until reset */
 static void cmd_proxy (BaseSequentialStream *chp, int argc, char *argv[])
 {
-//  DEBUG_INIT (chp);
-  BBI2C_t i2cdev01; /* Slave Mode for PC */
-  uint8_t data; /* captured Byte by Proxy */
-  uint8_t firstTime = 1;
-  uint8_t firstCI = 1;
-  uint8_t firstVCP = 1;
-  uint8_t ddcci_request_length;
-  uint8_t retrycap;
-  signed int returncode;
-
-  //Slave Device for Host - doe sn't need Start afterwards
-  BBI2C_Init (&i2cdev01, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_SLAVE);
+  uint8_t kvm = 0;
 
-  for(;;) /* No STOP - need to listen continuously */
+  if (argc == 2 && strcmp (argv[1], "kvm") == 0)
+  { /* all hosts share the monitor on port 1 */
+    kvm = 1;
+    argc--;
+  }
+  if (argc != 1)
   {
-
-    if (argc != 1)
-    {
-        chprintf (chp, "Argument error.\r\n");
-        chprintf (chp, "1: Original EDID\r\n");
-        chprintf (chp, "2: Fake EDID\r\n");
-        return;
-    }
-    data = BBI2C_Get_Byte (&i2cdev01);
-    switch (data) /* Actions depending on captured byte */
-    {
-      case MASTER_EDID_REQUEST:
-
-        if(firstTime) /* to have enough time to get edid, send invalid edid */
-        {
-          write_edid (&i2cdev01, dummyEDID);
-          firstTime--;
-          savedEDID = read_edid (); /* cache valid edid */
-          uint8_t module = atoi(argv[0]);
-          if (module == 2) savedEDID = edid_monitor_string_faker (savedEDID);
-        }
-
-        if(write_edid (&i2cdev01, savedEDID) != 0)
-        {
-          chprintf(chp, "Writing EDID to Host failed\r\n");
-        }
-        else /* EDID successfully sent to host */
-        {
-          chprintf(chp, "Sent EDID to Host\r\n");
-        }
-        break;
-
-      case MASTER_WRITE_REQUEST:
-        break;
-
-      /* encountered a ddcci command */
-      case MASTER_DDCCI_REQUEST:
-        data = BBI2C_Get_Byte (&i2cdev01);
-        if (data != MASTER_DDCCI_SOURCE_ADDRESS) break; /* break at wrong byte */
-        ddcci_request_length = BBI2C_Get_Byte (&i2cdev01); /* read length of the request */
-        ddcRequest = ddcci_read_master (&i2cdev01, ddcci_request_length); /* Read request from master */
-        data = BBI2C_Get_Byte (&i2cdev01);
-        switch (ddcRequest[3])
-        {
-          /* capabilies requested */
-          case MASTER_DDCCI_CAPABILITY_REQUEST:
-
-            if(ddcRequest[1] == 0xFF) /* invalid request */
-            {
-              chprintf (chp, "got invalid data for ddc/ci\r\n");
-              break;
-            }
-
-            /* for the first request, the invalid checksum must be sent */
-            if(firstCI)
-            {
-              if(data == MASTER_DDCCI_ANSWER_REQUEST)
-              {
-                signed int returncode;
-                returncode = ddcci_write_master (dummyCap, 6, 1);
-                if (returncode < 0) chprintf(chp, "no ack on bytes\r\n");
-                else if (returncode > 0) chprintf(chp, "ack on checksum\r\n");
-                else chprintf(chp, "transmission complete\r\n");
-              }
-              firstCI = 0;
-
-              /* First, gather information from slave about ddc/ci capabilities */
-              capRequest[4] = ddcRequest [4];
-              capRequest[5] = ddcRequest [5];
-              uint8_t retrycap = 5;
-              if(ddcci_write_slave (capRequest, 6) < 0)
-              {
-                  chprintf(chp, "ddcciwrite failed\r\n");
-                  break;
-              }
-              else
-              {
-                chprintf(chp, "ddcciwrite succeeded\r\n");
-                if(ddcci_read_slave(capAnswer) < 0)
-                {
-                  chprintf(chp, "failed reading ddc/ci, retrying\r\n");
-                  /* if the request to the slave failed, retry five times */
-                  while(retrycap)
-                  {
-                    if(ddcci_write_slave (capRequest, 6) == 0)
-                    {
-                      if(ddcci_read_slave(capAnswer) < 0)
-                      {
-                        chprintf(chp, "failed reading ddc/ci, retrying\r\n");
-                      }
-                      else break;
-                    }
-                    retrycap--;
-                  }
-                }
-              }
-            }
-            /* Now, send this information to the host */
-            uint8_t messageLength = capAnswer[1] & 0x7F;
-            if(data == MASTER_DDCCI_ANSWER_REQUEST) /* Master sent '6F' to read the answer */
-            {
-              chprintf(chp, "Ich sollte jetzt schreiben\r\n");
-              signed int returncode;
-              returncode = ddcci_write_master (capAnswer, messageLength + 3, 0);
-              if (returncode < 0) chprintf(chp, "no ack on bytes\r\n");
-              else if (returncode > 0)
-              {
-                chprintf(chp, "ack on checksum\r\n");
-                firstCI = 1;
-              }
-              else
-              {
-                chprintf(chp, "transmission complete\r\n");
-                firstCI = 1;
-              }
-            }
-            break;
-
-          /* master requests the VCP features, same principle as for capability request */
-          case MASTER_DDCCI_VCP_REQUEST:
-            chprintf(chp, "chp request");
-
-            if (firstVCP) /* first send the invalid VCP Feature answer */
-            {
-              if(data == MASTER_DDCCI_ANSWER_REQUEST)
-              {
-                signed int returncode;
-                dummyVCP[5] = ddcRequest[5];
-                returncode = ddcci_write_master (dummyVCP, 11, 1);
-                if (returncode < 0) chprintf(chp, "no ack on dummy bytes\r\n");
-                else if (returncode > 0) chprintf(chp, "ack on checksum\r\n");
-                else chprintf(chp, "transmission complete\r\n");
-              }
-              firstVCP = 0;
-
-              if(ddcRequest[1] == 0xFF)
-              {
-                chprintf (chp, "got invalid data for ddc/ci\r\n");
-                break;
-              }
-              retrycap = 5;
-              if(ddcci_write_slave (ddcRequest, 5) < 0)
-              {
-                  chprintf(chp, "ddcciwrite failed\r\n");
-                  break;
-              }
-              else
-              {
-                chprintf(chp, "ddcciwrite succeeded\r\n");
-                if(ddcci_read_slave(vcpAnswer) < 0)
-                {
-                  chprintf(chp, "failed reading ddc/ci, retrying\r\n");
-                  while(retrycap) /* retry, if reading of the slave failed */
-                  {
-                    if(ddcci_write_slave (ddcRequest, 5) == 0)
-                    {
-                      if(ddcci_read_slave(vcpAnswer) < 0)
-                      {
-                        chprintf(chp, "failed reading ddc/ci, retrying\r\n");
-                      }
-                      else break;
-                    }
-                    retrycap--;
-                  }
-                }
-              }
-            }
-
-            /* Send the answer to the master */
-            messageLength = 8;
-            if(data == MASTER_DDCCI_ANSWER_REQUEST)
-            {
-              chprintf(chp, "Ich sollte jetzt schreiben\r\n");
-              returncode = ddcci_write_master (vcpAnswer, messageLength + 3, 0);
-              if (returncode < 0) chprintf(chp, "no ack on bytes\r\n");
-              else if (returncode > 0)
-              {
-                chprintf(chp, "ack on checksum\r\n");
-                firstVCP = 1;
-              }
-              else
-              {
-                chprintf(chp, "transmission complete\r\n");
-                firstVCP = 1;
-              }
-            }
-            break;
-
-          /* Master wants to set a specific vcp command */
-          case MASTER_SET_CTRL_ADDRESS:
-            if(ddcRequest[1] == 0xFF)
-            {
-              chprintf (chp, "got invalid data for ddc/ci\r\n");
-              break;
-            }
-            retrycap = 5;
-            if(ddcci_write_slave (ddcRequest, 7) < 0)
-            {
-                chprintf(chp, "ddcciwrite failed\r\n");
-                break;
-            }
-            break;
-
-          /* master wants to save the settings */
-          case MASTER_SAVE_SETTINGS:
-            if(ddcRequest[1] == 0xFF)
-            {
-              chprintf (chp, "got invalid data for ddc/ci\r\n");
-              break;
-            }
-            retrycap = 5;
-            if(ddcci_write_slave (ddcRequest, 4) < 0)
-            {
-                chprintf(chp, "ddcciwrite failed\r\n");
-                break;
-            }
-            break;
-
-
-          default:
-            break;
-        }
-        break;
-
-      default:
-        break;
-    }
+      chprintf (chp, "Argument error.\r\n");
+      chprintf (chp, "1: Original EDID\r\n");
+      chprintf (chp, "2: Fake EDID\r\n");
+      chprintf (chp, "kvm after either: all hosts share the monitor on port 1\r\n");
+      return;
   }
+  if (proxy_start (atoi (argv[0]) == 2, kvm) < 0) chprintf (chp, "Proxy running\r\n");
 }
 
 
 static void cmd_fuzzer (BaseSequentialStream *chp, int argc, char *argv[])
 {
 
-  BBI2C_t i2cdev01;
+  port_t *port = &ports[PORT_1];
   uint8_t data;
   uint8_t init = 1;
   uint8_t module;
-  //Slave Device for Host - doe sn't need Start afterwards
-  BBI2C_Init (&i2cdev01, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_SLAVE);
 
   module = atoi(argv[0]);
 
@@ -355,19 +123,22 @@ static void cmd_fuzzer (BaseSequentialStream *chp, int argc, char *argv[])
 
   for(;;)
   {
-    data = BBI2C_Get_Byte (&i2cdev01);
+    data = BBI2C_Get_Byte (&port->host);
     if (data == 0xA1)
     {
       if (init)
       {
-        write_edid (&i2cdev01, dummyEDID);
-        savedEDID = read_edid ();
-        if(module==1) savedEDID = edid_fuzzer_unary (savedEDID);
-        else savedEDID = edid_fuzzer_complete ();
+        write_edid (port, dummyEDID);
+        stats_inc (&port->stats_host, STATS_DUMMY_EDID);
+        upstream_acquire (&port->upstream);
+        read_edid (port, port->edid);
+        upstream_release (&port->upstream);
+        if(module==1) edid_fuzzer_unary (port->edid);
+        else edid_fuzzer_complete (port->edid);
         init = 0;
       }
 
-      if(write_edid (&i2cdev01, savedEDID) != 0)
+      if(write_edid (port, port->edid) != 0)
       {
         chprintf(chp, "Writing EDID to Host failed\r\n");
       }
@@ -380,35 +151,41 @@ static void cmd_fuzzer (BaseSequentialStream *chp, int argc, char *argv[])
   }
 }
 
-static void cmd_sample (BaseSequentialStream *chp, int argc, char *argv[])
+/* Passive sniffer, streams decoded transactions as binary records until a key is pressed */
+static void cmd_sniff (BaseSequentialStream *chp, int argc, char *argv[])
 {
-    uint8_t data;
-    BBI2C_t i2cdev;
-    uint8_t samples[15];
-    uint8_t samplecount = 0;
-
-    DEBUG_INIT (chp);
+    uint8_t buses = SNIFFER_BUS_HOST;
+    uint8_t dma = 0;
+    int lost;
+
+    if (argc > 0 && strcmp (argv[argc - 1], "dma") == 0)
+    { /* timer-paced sampling, the CPU stays available to the proxy */
+        dma = 1;
+        argc--;
+    }
 
-    BBI2C_Init (&i2cdev, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_SLAVE);
+    if (argc == 1 && strcmp (argv[0], "monitor") == 0)
+    {
+        buses = SNIFFER_BUS_MONITOR;
+    }
+    else if (argc == 1 && strcmp (argv[0], "both") == 0)
+    { /* e.g. from a second board wired to both sides of a proxy */
+        buses = SNIFFER_BUS_HOST | SNIFFER_BUS_MONITOR;
+    }
+    else if (argc > 1 || (argc == 1 && strcmp (argv[0], "host") != 0))
+    {
+        chprintf (chp, "Usage: sniff [host|monitor|both] [dma]\r\n");
+        return;
+    }
 
-    //Store all captured Bytes in an array. Print after 10 captured bytes.
-    chprintf (chp, "Sampling Line: ");
-    for (;;)
+    lost = sniffer_run (buses, dma);
+    if (lost < 0)
+    {
+        chprintf (chp, "Capture busy\r\n");
+    }
+    else if (lost > 0)
     {
-        data = BBI2C_Get_Byte (&i2cdev);
-      	if(samplecount < 15)
-      	{
-          samples[samplecount] = data;
-      		samplecount++;
-      	}
-      	else
-      	{
-      		for(samplecount = 0; samplecount < 15; samplecount++)
-      		{
-      			chprintf(chp, "%x ", samples[samplecount]);
-      		}
-      		samplecount = 0;
-      	}
+        chprintf (chp, "%d edges lost\r\n", lost);
     }
 }
 
@@ -416,7 +193,7 @@ static void cmd_pintest (BaseSequentialStream *chp, int argc, char *argv[])
 {
     BBI2C_t i2cdev;
 
-    BBI2C_Init (&i2cdev, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_SLAVE);
+    port_host_bus (&ports[PORT_1], &i2cdev, BBI2C_MODE_SLAVE);
     for (;;)
     {
         chThdSleepMilliseconds(100);
@@ -428,14 +205,17 @@ static void cmd_pintest (BaseSequentialStream *chp, int argc, char *argv[])
 
 static void cmd_edid (BaseSequentialStream *chp, int argc, char *argv[])
 {
+  uint8_t edid[EDID_LENGTH];
   uint8_t i;
   uint8_t retry = 3;
 
   chprintf(chp, "Read EDID: \r\n");
   for(i = 0; i < retry; i++)
   {
-    savedEDID = read_edid();
-    if(savedEDID[0] == 0xFF)
+    upstream_acquire (&ports[PORT_1].upstream);
+    read_edid(&ports[PORT_1], edid);
+    upstream_release (&ports[PORT_1].upstream);
+    if(edid[0] == 0xFF)
     {
       chprintf(chp, "Reading EDID failed");
     }
@@ -443,7 +223,7 @@ static void cmd_edid (BaseSequentialStream *chp, int argc, char *argv[])
     {
       for(i = 0; i < 128; i++)
       {
-        chprintf(chp, "%x ", savedEDID[i]);
+        chprintf(chp, "%x ", edid[i]);
       }
       return;
     }
@@ -465,7 +245,7 @@ static void cmd_ddc (BaseSequentialStream *chp, int argc, char *argv[])
     addr = atoi (argv[0]);
     chprintf (chp, "Sending to %x\r\n", addr);
 
-    BBI2C_Init (&i2cdev, GPIOC, 10, GPIOC, 11, 50000, BBI2C_MODE_MASTER);
+    port_host_bus (&ports[PORT_1], &i2cdev, BBI2C_MODE_MASTER);
 
     BBI2C_Start (&i2cdev);
     ack = BBI2C_Send_Byte (&i2cdev, addr);
@@ -496,16 +276,20 @@ static void cmd_ddc (BaseSequentialStream *chp, int argc, char *argv[])
 static void cmd_ddcci (BaseSequentialStream *chp, int argc, char *argv[])
 {
 
+  uint8_t edid[EDID_LENGTH];
+  uint8_t capRequest[7] = {0x6E, 0x51, 0x83, 0xF3, 0x00, 0x00};
+  uint8_t capAnswer[DDCCI_FRAME_MAX];
   uint8_t i;
   uint8_t retry = 3;
   uint8_t offhi, offlo;
   uint8_t retrycap;
 
+  upstream_acquire (&ports[PORT_1].upstream); /* the proxy shares the monitor bus */
   chprintf(chp, "Read EDID: \r\n");
   for(i = 0; i < retry; i++)
   {
-    savedEDID = read_edid();
-    if(savedEDID[0] == 0xFF)
+    read_edid(&ports[PORT_1], edid);
+    if(edid[0] == 0xFF)
     {
       chprintf(chp, "Reading EDID failed \r\n");
     }
@@ -513,7 +297,7 @@ static void cmd_ddcci (BaseSequentialStream *chp, int argc, char *argv[])
     {
       for(i = 0; i < 128; i++)
       {
-        chprintf(chp, "%x ", savedEDID[i]);
+        chprintf(chp, "%x ", edid[i]);
       }
       chprintf(chp, "\r\n");
       break;
@@ -521,30 +305,31 @@ static void cmd_ddcci (BaseSequentialStream *chp, int argc, char *argv[])
   }
 
   chprintf(chp, "Write to DDC/CI\r\n");
+  ddcci_frame_seal (capRequest);
   uint16_t offsetlist[10] = {0x00, 0x20, 0x40, 0x60, 0x80, 0xA0, 0xC0, 0xE0, 0xFE, 0x108};
   for(int z = 0; z < 10; z++)
   {
     offhi = offsetlist[z] >> 8;
     offlo = offsetlist[z] & 255;
-    capRequest[4] = offhi;
-    capRequest[5] = offlo;
+    ddcci_frame_set (capRequest, 4, offhi);
+    ddcci_frame_set (capRequest, 5, offlo);
     retrycap = 5;
 
-    if(ddcci_write_slave (capRequest, 6) < 0)
+    if(ddcci_write_slave (&ports[PORT_1], capRequest) < 0)
     {
       chprintf(chp, "ddcciwrtie failed\r\n");
     }
     else
     {
        chprintf(chp, "ddcciwrite succeeded\r\n");
-       if(ddcci_read_slave(capAnswer) < 0)
+       if(ddcci_read_slave(&ports[PORT_1], capAnswer) < 0)
        {
          chprintf(chp, "failed reading ddc/ci, retrying\r\n");
          while(retrycap)
          {
-           if(ddcci_write_slave (capRequest, 6) == 0)
+           if(ddcci_write_slave (&ports[PORT_1], capRequest) == 0)
            {
-             if(ddcci_read_slave(capAnswer) < 0)
+             if(ddcci_read_slave(&ports[PORT_1], capAnswer) < 0)
              {
                chprintf(chp, "failed reading ddc/ci, retrying\r\n");
              }  else break;
@@ -560,17 +345,368 @@ static void cmd_ddcci (BaseSequentialStream *chp, int argc, char *argv[])
     }
     chprintf(chp, "\r\n", capAnswer[i]);
   }
+  upstream_release (&ports[PORT_1].upstream);
+}
+
+/* Mirror VCP codes of the monitor in the background, changes are streamed over USB */
+static void cmd_mirror (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  uint8_t codes[MIRROR_CODES_MAX];
+  uint32_t period;
+  int i;
+
+  if (argc == 0)
+  {
+    mirror_show (chp);
+    return;
+  }
+
+  if (argc == 1 && strcmp (argv[0], "stop") == 0)
+  {
+    mirror_stop ();
+    return;
+  }
+
+  if (argc < 2 || argc - 1 > MIRROR_CODES_MAX)
+  {
+    chprintf (chp, "Usage: mirror <period ms> <vcp code>...\r\n");
+    chprintf (chp, "       mirror stop\r\n");
+    return;
+  }
+
+  period = strtol (argv[0], NULL, 0);
+  for (i = 1; i < argc; i++)
+  {
+    codes[i-1] = strtol (argv[i], NULL, 0);
+  }
+
+  if (mirror_start (period, codes, argc - 1) < 0)
+  {
+    chprintf (chp, "Starting mirror failed\r\n");
+  }
+}
+
+/* Get VCP for one code, polling for the reply instead of waiting a fixed 40 ms */
+static int vcpscan_code (port_t *port, uint8_t code, uint32_t *gap, uint8_t *reply)
+{
+  uint8_t request[6] = {0x6E, 0x51, 0x82, 0x01, code};
+  systime_t start = chVTGetSystemTimeX();
+
+  ddcci_frame_seal (request);
+  while (ddcci_write_slave (port, request) < 0)
+  { /* NACK, the monitor wants more time between requests */
+    if (*gap < VCPSCAN_GAP_MAX_MS) *gap *= 2;
+    if (chVTTimeElapsedSinceX (start) > MS2ST (VCPSCAN_TIMEOUT_MS)) return -1;
+    chThdSleepMilliseconds (*gap);
+  }
+
+  for (;;)
+  {
+    chThdSleepMilliseconds (*gap);
+    if (ddcci_read_reply (port, reply) == 0 && !checkNullMessage (reply[1]))
+    {
+      if (reply[2] == 0x02 && reply[4] == code) return 0;
+    }
+    if (chVTTimeElapsedSinceX (start) > MS2ST (VCPSCAN_TIMEOUT_MS)) return -1;
+  }
+}
+
+/* Read all supported VCP codes of the monitor back-to-back */
+static void cmd_vcpscan (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  static uint8_t caps[VCPSCAN_CAPS_SIZE];
+  port_t *port = &ports[PORT_1];
+  uint8_t supported[32];
+  uint8_t reply[DDCCI_FRAME_MAX];
+  uint32_t gap = VCPSCAN_GAP_MIN_MS;
+  systime_t start, begin;
+  int len, count, code, column = 0;
+
+  (void)argv;
+  if (argc != 0)
+  {
+    chprintf (chp, "Usage: vcpscan\r\n");
+    return;
+  }
+
+  upstream_acquire (&port->upstream);
+  begin = chVTGetSystemTimeX();
+
+  len = ddcci_read_capabilities (port, caps, sizeof(caps));
+  count = (len > 0) ? ddcci_capabilities_vcp (caps, len, supported) : -1;
+  if (count <= 0)
+  { /* no usable capabilities, probe the whole VCP space */
+    chprintf (chp, "No vcp() in capabilities, scanning all codes\r\n");
+    for (code = 0; code < 32; code++) supported[code] = 0xFF;
+    count = 256;
+  }
+  chprintf (chp, "Scanning %d codes\r\n", count);
+
+  for (code = 0; code < 256; code++)
+  {
+    if (!(supported[code / 8] & (1 << (code % 8)))) continue;
+
+    start = chVTGetSystemTimeX();
+    if (vcpscan_code (port, code, &gap, reply) < 0)
+    {
+      chprintf (chp, "%02x      -/-      timeout  ", code);
+    }
+    else if (reply[3] != 0)
+    {
+      chprintf (chp, "%02x    unsupported %6u us  ", code, chVTTimeElapsedSinceX (start) / (CH_CFG_ST_FREQUENCY / 1000000));
+    }
+    else
+    {
+      chprintf (chp, "%02x %5u/%-5u %6u us  ", code, (reply[8] << 8) | reply[9], (reply[6] << 8) | reply[7],
+                chVTTimeElapsedSinceX (start) / (CH_CFG_ST_FREQUENCY / 1000000));
+    }
+    if (++column % 3 == 0) chprintf (chp, "\r\n");
+  }
+
+  upstream_release (&port->upstream);
+  chprintf (chp, "\r\nDone in %u ms, gap %u ms\r\n", chVTTimeElapsedSinceX (begin) / (CH_CFG_ST_FREQUENCY / 1000), gap);
+}
+
+/* CPU cycles the log calls of one proxied DDC/CI reply cost at the compiled log level */
+static void cmd_logcost (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  uint8_t frame[11] = {0x6E, 0x88, 0x02, 0x00, 0x10, 0x00, 0x00, 0x64, 0x00, 0x32, 0x00};
+  rtcnt_t start, cycles = 0;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  for (i = 0; i < 8; i++)
+  { /* the calls ddcci_read_reply and ddcci_write_master make per reply */
+    start = chSysGetRealtimeCounterX();
+    log_reply_received (frame, sizeof(frame));
+    log_reply_sent (frame, sizeof(frame));
+    cycles += chSysGetRealtimeCounterX() - start;
+  }
+  chprintf (chp, "log level %d: %u cycles per reply\r\n", LOG_LEVEL, cycles / 8);
+}
+
+/* Protocol counters of the host and monitor bus of every port, '-m' prints key=value lines for scripts */
+static void cmd_stats (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  if (argc == 1 && strcmp (argv[0], "reset") == 0)
+  {
+    stats_reset ();
+  }
+  else if (argc == 0 || (argc == 1 && strcmp (argv[0], "-m") == 0))
+  {
+    stats_print (chp, argc == 1);
+  }
+  else
+  {
+    chprintf (chp, "Usage: stats [-m|reset]\r\n");
+  }
+}
+
+/* Latency percentiles per opcode, measured at the bus transaction boundaries */
+static void cmd_latency (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  if (argc == 1 && strcmp (argv[0], "reset") == 0)
+  {
+    latency_reset ();
+  }
+  else if (argc == 0)
+  {
+    latency_print (chp);
+  }
+  else
+  {
+    chprintf (chp, "Usage: latency [reset]\r\n");
+  }
+}
+
+/* Bit-level capture of both buses, armed with a trigger and dumped once it fired */
+static void cmd_trace (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  static const char * const states[] = {"idle", "armed", "triggered", "done"};
+  trace_trigger_t trigger;
+  uint8_t address = 0;
+  int pretrigger = TRACE_BYTES / 4;
+  int next = 2;
+
+  if (argc == 0)
+  {
+    chprintf (chp, "trace %s\r\n", states[trace_state ()]);
+    return;
+  }
+  if (argc == 1 && strcmp (argv[0], "stop") == 0)
+  {
+    trace_stop ();
+    return;
+  }
+  if (argc == 1 && strcmp (argv[0], "dump") == 0)
+  {
+    trace_dump (chp);
+    return;
+  }
+  if (argc == 1 && strcmp (argv[0], "raw") == 0)
+  {
+    trace_dump_binary (chp);
+    return;
+  }
 
+  if (argc >= 2 && strcmp (argv[0], "arm") == 0)
+  {
+    if (strcmp (argv[1], "start") == 0) trigger = TRACE_TRIGGER_START;
+    else if (strcmp (argv[1], "nack") == 0) trigger = TRACE_TRIGGER_NACK;
+    else if (strcmp (argv[1], "addr") == 0 && argc >= 3)
+    {
+      trigger = TRACE_TRIGGER_ADDRESS;
+      address = strtol (argv[2], NULL, 16);
+      next = 3;
+    }
+    else next = 0;
+
+    if (next && argc <= next + 1)
+    {
+      if (argc == next + 1) pretrigger = atoi (argv[next]);
+      trace_arm (trigger, address, pretrigger);
+      return;
+    }
+  }
+
+  chprintf (chp, "Usage: trace [arm start|nack|addr <hex> [pretrigger]|stop|dump|raw]\r\n");
+}
+
+/* Recent proxied transactions with the latency the proxy added on top of the monitor */
+static void cmd_correlate (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  if (argc == 1 && strcmp (argv[0], "reset") == 0)
+  {
+    correlate_reset ();
+  }
+  else if (argc == 0)
+  {
+    correlate_print (chp);
+  }
+  else
+  {
+    chprintf (chp, "Usage: correlate [reset]\r\n");
+  }
+}
+
+/* Measure the host's bus timing and tune the software slave to it */
+static void cmd_timing (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  int transactions = 50;
+  int measured;
+  long delay;
+
+  if (argc == 1 && strcmp (argv[0], "reset") == 0)
+  { /* back to the delay derived from the nominal frequency */
+    BBI2C_Set_Slave_Delay (-1);
+    return;
+  }
+  if (argc == 2 && strcmp (argv[0], "master") == 0 && atoi (argv[1]) > 0)
+  { /* the monitor-side master at the given SCL frequency, timed by the cycle counter */
+    if (timing_master (atoi (argv[1])) < 0) chprintf (chp, "Monitor query failed\r\n");
+    timing_print (chp);
+    return;
+  }
+  if (argc == 1) transactions = atoi (argv[0]);
+  if (argc > 1 || transactions <= 0)
+  {
+    chprintf (chp, "Usage: timing [transactions|reset|master <frequency>]\r\n");
+    return;
+  }
+
+  chprintf (chp, "Measuring %d host transactions, press any key to stop\r\n", transactions);
+  measured = timing_measure (transactions);
+  if (measured < 0)
+  {
+    chprintf (chp, "Capture busy\r\n");
+    return;
+  }
+  timing_print (chp);
+
+  delay = timing_slave_delay ();
+  if (delay >= 0)
+  {
+    BBI2C_Set_Slave_Delay (delay);
+    chprintf (chp, "Slave sampling delay set to %u\r\n", (unsigned)delay);
+  }
+}
+
+/* Find the fastest monitor-side timing that stays error-free and store it for this monitor */
+static void cmd_profile (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  port_t *port = &ports[PORT_1];
+  uint8_t edid[EDID_LENGTH];
+  int samples = PROFILE_SAMPLES;
+  int status;
+
+  if (argc == 1 && strcmp (argv[0], "show") == 0)
+  {
+    profile_print (chp);
+    return;
+  }
+  if (argc == 1 && strcmp (argv[0], "clear") == 0)
+  {
+    profile_clear ();
+    return;
+  }
+  if (argc == 1) samples = atoi (argv[0]);
+  if (argc > 1 || samples <= 0)
+  {
+    chprintf (chp, "Usage: profile [samples|show|clear]\r\n");
+    return;
+  }
+
+  upstream_acquire (&port->upstream);
+  status = read_edid (port, edid);
+  upstream_release (&port->upstream);
+  if (status < 0)
+  {
+    chprintf (chp, "Reading EDID failed\r\n");
+    return;
+  }
+
+  chprintf (chp, "Profiling %02x%02x:%02x%02x with %d samples per setting, press any key to stop\r\n",
+            edid[8], edid[9], edid[11], edid[10], samples);
+  status = profile_measure (chp, port, edid, samples);
+  if (status == -1) chprintf (chp, "Monitor fails with the default timing\r\n");
+  else if (status == -2) chprintf (chp, "Aborted, default timing restored\r\n");
+  else if (status == -3) chprintf (chp, "Monitor fails intermittently, default timing restored\r\n");
+}
+
+/* Monitor-side transactions per second, every port alone and all ports in parallel */
+static void cmd_bench (BaseSequentialStream *chp, int argc, char *argv[])
+{
+  int seconds = 5;
+
+  if (argc == 1) seconds = atoi (argv[0]);
+  if (argc > 1 || seconds <= 0)
+  {
+    chprintf (chp, "Usage: bench [seconds]\r\n");
+    return;
+  }
+  port_benchmark (chp, seconds);
 }
 
 static const ShellCommand commands[] = {
   {"proxy", cmd_proxy},
   {"fuzzer", cmd_fuzzer},
-  {"sample", cmd_sample},
+  {"sniff", cmd_sniff},
   {"pintest", cmd_pintest},
   {"edid", cmd_edid},
   {"ddc", cmd_ddc},
   {"comm", cmd_ddcci},
+  {"mirror", cmd_mirror},
+  {"vcpscan", cmd_vcpscan},
+  {"logcost", cmd_logcost},
+  {"stats", cmd_stats},
+  {"latency", cmd_latency},
+  {"trace", cmd_trace},
+  {"correlate", cmd_correlate},
+  {"timing", cmd_timing},
+  {"profile", cmd_profile},
+  {"bench", cmd_bench},
   {NULL, NULL}
 };
 
@@ -621,6 +757,18 @@ int main(void) {
   sduObjectInit(&SDU1);
   sduStart(&SDU1, &serusbcfg);
 
+  /*
+   * Deferred logging for the bus code, flushed to SDU1 in the background.
+   */
+  log_start();
+
+  /*
+   * Frame pool and bus pairs with their monitor-side workers, the proxy
+   * threads are started by the 'proxy' command.
+   */
+  ddcci_init();
+  port_init();
+
   /*
    * Activates the USB driver and then the USB bus pull-up on D+.
    * Note, a delay is inserted in order to not have to disconnect the cable
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * VCP mirror. A background thread polls a set of VCP codes on the monitor,
+ * e.g. to notice changes made through the OSD buttons, and streams every
+ * change as a binary record over USB. Polls are spread evenly over the
+ * period and skipped while the proxy has requests queued for the monitor.
+ * The records are interleaved with the shell's text on the same serial
+ * stream, see mirror_record_t for how a reader separates them.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "opcodes.h"
+#include "upstream.h"
+#include "port.h"
+#include "mirror.h"
+
+#include "chprintf.h"
+
+typedef struct
+{
+  uint8_t  code;
+  uint8_t  valid;
+  uint16_t value;
+  uint16_t max;
+  systime_t changed;
+} mirror_entry_t;
+
+static mirror_entry_t table[MIRROR_CODES_MAX];
+static uint8_t  tableSize;
+static uint32_t pollGap;  /* milliseconds between two polls */
+static uint8_t  running;
+static uint32_t dropped;  /* records not sent completely */
+
+static MUTEX_DECL(lock);
+static BSEMAPHORE_DECL(wakeup, true);
+
+static void mirror_emit (mirror_entry_t *entry)
+{
+  mirror_record_t record;
+  uint8_t *raw = (uint8_t *)&record;
+  uint8_t i;
+
+  record.sync      = MIRROR_RECORD_SYNC;
+  record.length    = sizeof(record);
+  record.code      = entry->code;
+  record.value     = entry->value;
+  record.max       = entry->max;
+  record.timestamp = entry->changed / (CH_CFG_ST_FREQUENCY / 1000);
+  record.check     = 0;
+  for (i = 0; i < sizeof(record) - 1; i++) record.check ^= raw[i];
+
+  /*
+   * Never block on the host. With the USB buffers full the record is cut
+   * short or not sent at all; the reader drops what fails the check byte.
+   */
+  if (chnWriteTimeout (&SDU1, raw, sizeof(record), TIME_IMMEDIATE) < sizeof(record))
+  {
+    dropped++;
+  }
+}
+
+/* read one VCP code, returns 1 if the value changed */
+static int mirror_poll (mirror_entry_t *entry)
+{
+  uint8_t request[6] = {0x6E, 0x51, 0x82, DDCCI_OP_GET_VCP, entry->code};
+  uint8_t reply[DDCCI_FRAME_MAX];
+  uint16_t value, max;
+
+  ddcci_frame_seal (request);
+  if (upstream_background (&ports[PORT_1].upstream, request, &ddcci_opcodes[DDCCI_OP_GET_VCP], reply) < 0) return 0;
+  if (checkNullMessage (reply[1]) || reply[3] != 0) return 0; /* busy or unsupported code */
+  if ((reply[1] & 0x7F) != 8 || reply[2] != DDCCI_OP_GET_VCP_REPLY || reply[4] != entry->code) return 0;
+
+  max   = (reply[6] << 8) | reply[7];
+  value = (reply[8] << 8) | reply[9];
+  if (entry->valid && entry->value == value && entry->max == max) return 0;
+
+  entry->value   = value;
+  entry->max     = max;
+  entry->valid   = 1;
+  entry->changed = chVTGetSystemTimeX();
+  return 1;
+}
+
+static THD_WORKING_AREA(mirrorThreadWA, 1024);
+static THD_FUNCTION(mirrorThread, arg)
+{
+  uint8_t index = 0;
+  uint32_t gap;
+  mirror_entry_t entry;
+
+  (void)arg;
+  chRegSetThreadName("mirror");
+
+  for (;;)
+  {
+    chMtxLock (&lock);
+    while (!running)
+    {
+      chMtxUnlock (&lock);
+      chBSemWait (&wakeup);
+      chMtxLock (&lock);
+      index = 0;
+    }
+    gap = pollGap;
+    chMtxUnlock (&lock);
+
+    chThdSleepMilliseconds (gap);
+    if (!upstream_idle (&ports[PORT_1].upstream)) continue; /* host traffic first, try again next slot */
+
+    chMtxLock (&lock);
+    if (!running || index >= tableSize)
+    {
+      index = 0;
+      chMtxUnlock (&lock);
+      continue;
+    }
+    entry = table[index];
+    chMtxUnlock (&lock);
+
+    if (mirror_poll (&entry))
+    {
+      chMtxLock (&lock);
+      if (running && index < tableSize && table[index].code == entry.code)
+      {
+        table[index] = entry;
+      }
+      chMtxUnlock (&lock);
+      mirror_emit (&entry);
+    }
+    index++;
+  }
+}
+
+/* mirror 'count' VCP codes, each one polled once per 'period' milliseconds */
+int mirror_start (uint32_t period, uint8_t *codes, uint8_t count)
+{
+  static thread_t *poller = NULL;
+  uint8_t i;
+
+  if (count == 0 || count > MIRROR_CODES_MAX) return -1;
+
+  chMtxLock (&lock);
+  for (i = 0; i < count; i++)
+  {
+    table[i].code  = codes[i];
+    table[i].valid = 0;
+  }
+  tableSize = count;
+  pollGap = period / count;
+  if (pollGap < MIRROR_MIN_GAP_MS) pollGap = MIRROR_MIN_GAP_MS;
+  running = 1;
+  chMtxUnlock (&lock);
+
+  if (!poller)
+  {
+    poller = chThdCreateStatic (mirrorThreadWA, sizeof(mirrorThreadWA), NORMALPRIO-2, mirrorThread, NULL);
+  }
+  chBSemSignal (&wakeup);
+  return 0;
+}
+
+void mirror_stop (void)
+{
+  chMtxLock (&lock);
+  running = 0;
+  chMtxUnlock (&lock);
+}
+
+void mirror_show (BaseSequentialStream *chp)
+{
+  mirror_entry_t snapshot[MIRROR_CODES_MAX];
+  uint8_t i, size;
+  uint32_t gap, lost;
+
+  chMtxLock (&lock);
+  size = tableSize;
+  gap = pollGap;
+  lost = dropped;
+  memcpy (snapshot, table, sizeof(snapshot));
+  chMtxUnlock (&lock);
+
+  chprintf (chp, "%s, %d ms between polls, %d records dropped\r\n", running ? "running" : "stopped", gap, lost);
+  for (i = 0; i < size; i++)
+  {
+    if (snapshot[i].valid)
+    {
+      chprintf (chp, "%02x: %5d / %5d\r\n", snapshot[i].code, snapshot[i].value, snapshot[i].max);
+    }
+    else
+    {
+      chprintf (chp, "%02x: -\r\n", snapshot[i].code);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MIRROR_H
+#define MIRROR_H
+
+/* Most VCP codes mirrored at the same time */
+#define MIRROR_CODES_MAX 16
+
+/* DDC/CI wants at least this much time between two requests to the monitor */
+#define MIRROR_MIN_GAP_MS 50
+
+#define MIRROR_RECORD_SYNC 0xA5
+
+/*
+ * Change notification streamed over USB whenever a mirrored value changes.
+ * Records share the serial stream with the shell and log output, so a reader
+ * has to find them among text: it looks for MIRROR_RECORD_SYNC followed by
+ * the record length and only accepts the record if the check byte matches,
+ * otherwise it skips the sync byte and searches on.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t  sync;       /* MIRROR_RECORD_SYNC */
+    uint8_t  length;     /* sizeof(mirror_record_t) */
+    uint8_t  code;       /* VCP code */
+    uint16_t value;      /* current value, little endian */
+    uint16_t max;        /* maximum value, little endian */
+    uint32_t timestamp;  /* milliseconds since boot, little endian */
+    uint8_t  check;      /* XOR of all preceding bytes */
+} mirror_record_t;
+
+int mirror_start (uint32_t period, uint8_t *codes, uint8_t count);
+void mirror_stop (void);
+void mirror_show (BaseSequentialStream *chp);
+
+#endif // MIRROR_H
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "opcodes.h"
+#include "upstream.h"
+#include "port.h"
+
+/*
+ * Opcode registry, indexed by the opcode byte of the host request. Opcodes
+ * without a handler are ignored by the proxy. The windows are the waits the
+ * DDC/CI standard asks of the host after each request.
+ */
+const ddcci_opcode_t ddcci_opcodes[256] =
+{
+    [DDCCI_OP_GET_VCP] =
+        {"getvcp", ddcci_forward, DDCCI_CACHE_VOLATILE, DDCCI_REPLY_FRAME, DDCCI_OP_GET_VCP_REPLY, 40},
+    [DDCCI_OP_SET_VCP] =
+        {"setvcp", ddcci_forward, DDCCI_CACHE_NONE, DDCCI_REPLY_NONE, 0, 50, DDCCI_OP_GET_VCP},
+    [DDCCI_OP_TIMING_REPORT] =
+        {"timing", ddcci_forward, DDCCI_CACHE_NONE, DDCCI_REPLY_FRAME, DDCCI_OP_TIMING_REPLY, 40},
+    [DDCCI_OP_SAVE_SETTINGS] =
+        {"save", ddcci_forward, DDCCI_CACHE_NONE, DDCCI_REPLY_NONE, 0, 200, DDCCI_OP_GET_VCP},
+    [DDCCI_OP_TABLE_READ] =
+        {"tableread", ddcci_forward, DDCCI_CACHE_REPLY, DDCCI_REPLY_FRAME, DDCCI_OP_TABLE_READ_REPLY, 50},
+    [DDCCI_OP_TABLE_WRITE] =
+        {"tablewrite", ddcci_forward, DDCCI_CACHE_NONE, DDCCI_REPLY_NONE, 0, 50, DDCCI_OP_TABLE_READ},
+    [DDCCI_OP_IDENTIFICATION] =
+        {"ident", ddcci_forward, DDCCI_CACHE_REPLY, DDCCI_REPLY_FRAME, DDCCI_OP_IDENTIFICATION_REPLY, 50},
+    [DDCCI_OP_CAPABILITIES] =
+        {"caps", ddcci_forward, DDCCI_CACHE_REPLY, DDCCI_REPLY_FRAME, DDCCI_OP_CAPABILITIES_REPLY, 50},
+};
+
+/* number of bytes to forward: address, source, length and payload, without checksum */
+uint8_t ddcci_frame_length (uint8_t *frame)
+{
+  return (frame[2] & 0x7F) + 3;
+}
+
+/* request opcodes the proxy handles, the others are refused while the frame arrives */
+uint8_t ddcci_known_request (uint8_t opcode)
+{
+  return ddcci_opcodes[opcode].handler != NULL;
+}
+
+/* reply opcodes a display sends to the requests above */
+uint8_t ddcci_known_reply (uint8_t opcode)
+{
+  uint16_t i;
+
+  for (i = 0; i < 256; i++)
+  {
+    if (ddcci_opcodes[i].handler && ddcci_opcodes[i].reply == DDCCI_REPLY_FRAME &&
+        ddcci_opcodes[i].reply_opcode == opcode) return 1;
+  }
+  return 0;
+}
+
+/* default handler, pass the received frame on to the monitor-side worker serving the port */
+int ddcci_forward (port_t *port, const ddcci_opcode_t *op, uint8_t *frame)
+{
+  upstream_submit (port->engine, port->id, frame, op);
+  return 0;
+}
+
+int ddcci_dispatch (port_t *port, uint8_t *frame)
+{
+  const ddcci_opcode_t *op = &ddcci_opcodes[frame[3]];
+
+  if (!op->handler) return -1; /* unknown opcode */
+  if (ddcci_frame_length (frame) >= DDCCI_FRAME_MAX) return -1;
+  return op->handler (port, op, frame);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OPCODES_H
+#define OPCODES_H
+
+/* DDC/CI request opcodes sent by the host */
+#define DDCCI_OP_GET_VCP         0x01
+#define DDCCI_OP_SET_VCP         0x03
+#define DDCCI_OP_TIMING_REPORT   0x07
+#define DDCCI_OP_SAVE_SETTINGS   0x0C
+#define DDCCI_OP_TABLE_READ      0xE2
+#define DDCCI_OP_TABLE_WRITE     0xE7
+#define DDCCI_OP_IDENTIFICATION  0xF1
+#define DDCCI_OP_CAPABILITIES    0xF3
+
+/* DDC/CI reply opcodes sent by the display */
+#define DDCCI_OP_GET_VCP_REPLY        0x02
+#define DDCCI_OP_TIMING_REPLY         0x4E
+#define DDCCI_OP_IDENTIFICATION_REPLY 0xE1
+#define DDCCI_OP_CAPABILITIES_REPLY   0xE3
+#define DDCCI_OP_TABLE_READ_REPLY     0xE4
+
+typedef enum
+{
+    DDCCI_CACHE_NONE,     /* always ask the monitor */
+    DDCCI_CACHE_REPLY,    /* reply only depends on the request, serve it from the cache */
+    DDCCI_CACHE_VOLATILE  /* may also change through the OSD, serve it for UPSTREAM_VOLATILE_MS */
+} ddcci_cache_t;
+
+typedef enum
+{
+    DDCCI_REPLY_NONE,   /* write-only request */
+    DDCCI_REPLY_FRAME   /* monitor answers with a single frame carrying reply_opcode */
+} ddcci_reply_t;
+
+typedef struct ddcci_opcode ddcci_opcode_t;
+
+struct port;
+
+/* handles a validated request frame received from the host of 'port', a handler
+   keeping the pool frame beyond the call holds it with ddcci_frame_ref */
+typedef int (*ddcci_handler_t) (struct port *port, const ddcci_opcode_t *op, uint8_t *frame);
+
+struct ddcci_opcode
+{
+    const char      *name;
+    ddcci_handler_t handler;
+    ddcci_cache_t   cache;
+    ddcci_reply_t   reply;
+    uint8_t         reply_opcode;
+    uint16_t        window_ms;    /* the host reads the reply or sends its next request after this long */
+    uint8_t         invalidates;  /* cached replies to this opcode for the same code, or all without one, become stale */
+};
+
+extern const ddcci_opcode_t ddcci_opcodes[256];
+
+uint8_t ddcci_frame_length (uint8_t *frame);
+uint8_t ddcci_known_request (uint8_t opcode);
+uint8_t ddcci_known_reply (uint8_t opcode);
+int ddcci_forward (struct port *port, const ddcci_opcode_t *op, uint8_t *frame);
+int ddcci_dispatch (struct port *port, uint8_t *frame);
+
+#endif // OPCODES_H
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Host/monitor bus pairs. Every port has its own monitor-side worker,
+ * reply cache, timing and counters, and a proxy thread serving its host.
+ * Proxy threads sleep until the EXTI line of their host SDA pin reports
+ * a START, so idle ports cost no CPU time.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "port.h"
+
+#include "chprintf.h"
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+
+/* nominal host clock, the slave derives its sampling delay from it */
+#define PORT_HOST_FREQUENCY 50000
+
+#define PORT_ENTRY(pid, label, hsda, hscl, msda, mscl) \
+    [pid] = { .id = pid, .name = label, .host_sda = hsda, .host_scl = hscl, .monitor_sda = msda, .monitor_scl = mscl, \
+              .stats_host = {"host" label, {0}}, .stats_monitor = {"monitor" label, {0}}, \
+              .timing = DDCCI_TIMING_DEFAULT },
+
+port_t ports[PORT_COUNT] = { PORT_TABLE(PORT_ENTRY) };
+
+/* port listening on each EXTI line, channels are filled in by port_init */
+static port_t *lines[16];
+static EXTConfig extcfg;
+
+typedef struct
+{
+  port_t *port;
+  systime_t duration;
+  uint32_t transactions;
+  uint32_t failed;
+} port_bench_t;
+
+/* SDA falling: a START if SCL is high, a data bit otherwise */
+static void port_start_cb (EXTDriver *extp, expchannel_t channel)
+{
+  port_t *port = lines[channel];
+
+  (void)extp;
+  if (!palReadPad (GPIOC, port->host_scl)) return;
+
+  port->startTime = chSysGetRealtimeCounterX();
+  chSysLockFromISR();
+  chBSemSignalI (&port->start);
+  chSysUnlockFromISR();
+}
+
+void port_init (void)
+{
+  port_t *port;
+  uint8_t i;
+
+  chDbgAssert (PORT_COUNT <= UPSTREAM_CLIENTS, "a worker must serve all hosts in KVM mode");
+  for (i = 0; i < PORT_COUNT; i++)
+  {
+    port = &ports[i];
+    port_host_bus (port, &port->host, BBI2C_MODE_SLAVE);
+    BBI2C_Init (&port->monitor, GPIOC, port->monitor_sda, GPIOC, port->monitor_scl,
+                port->timing.write_frequency, BBI2C_MODE_MASTER);
+    port->monitor.stats = &port->stats_monitor;
+    port->engine = &port->upstream;
+    chBSemObjectInit (&port->start, TRUE);
+    upstream_start (&port->upstream, port);
+
+    lines[port->host_sda] = port;
+    extcfg.channels[port->host_sda].mode = EXT_CH_MODE_FALLING_EDGE | EXT_MODE_GPIOC;
+    extcfg.channels[port->host_sda].cb = port_start_cb;
+  }
+  extStart (&EXTD1, &extcfg);
+}
+
+/* master towards the monitor of 'port', retimed only if 'frequency' changed since the last transfer */
+BBI2C_t * port_monitor_bus (port_t *port, uint32_t frequency)
+{
+  BBI2C_Set_Frequency (&port->monitor, frequency);
+  return &port->monitor;
+}
+
+/* the host bus of 'port', as the slave the proxy is or for tests as master */
+void port_host_bus (port_t *port, BBI2C_t *dev, BBI2C_Mode_t mode)
+{
+  BBI2C_Init (dev, GPIOC, port->host_sda, GPIOC, port->host_scl, PORT_HOST_FREQUENCY, mode);
+  dev->stats = &port->stats_host;
+}
+
+/*
+ * Sleep until the host of 'port' sends a START. Returns -1 if this thread
+ * got the CPU too late to follow the address byte, the host then sees no
+ * ACK and retries.
+ */
+int port_wait_start (port_t *port)
+{
+  chBSemReset (&port->start, TRUE);
+  extChannelEnable (&EXTD1, port->host_sda);
+  chBSemWait (&port->start);
+  extChannelDisable (&EXTD1, port->host_sda);
+
+  if (chSysGetRealtimeCounterX() - port->startTime > PORT_START_LATENCY_US * CYCLES_PER_US)
+  {
+    stats_inc (&port->stats_host, STATS_MISSED);
+    return -1;
+  }
+  BBI2C_Start_Seen (&port->host);
+  return 0;
+}
+
+/* back-to-back brightness queries to one monitor */
+static THD_FUNCTION(benchThread, arg)
+{
+  port_bench_t *bench = arg;
+  uint8_t request[6] = {0x6E, 0x51, 0x82, 0x01, 0x10};
+  uint8_t reply[DDCCI_FRAME_MAX];
+  systime_t start = chVTGetSystemTimeX();
+
+  chRegSetThreadName("bench");
+  ddcci_frame_seal (request);
+  while (chVTTimeElapsedSinceX (start) < bench->duration)
+  {
+    if (upstream_query (&bench->port->upstream, request,
+              &ddcci_opcodes[DDCCI_OP_GET_VCP], reply) == 0 && !checkNullMessage (reply[1]))
+    {
+      bench->transactions++;
+    }
+    else bench->failed++;
+  }
+}
+
+/* run the queries on the ports in 'mask' in parallel, returns the total transactions */
+static uint32_t port_bench_run (BaseSequentialStream *chp, port_bench_t *bench, uint32_t mask, uint32_t seconds)
+{
+  thread_t *threads[PORT_COUNT];
+  uint32_t total = 0;
+  uint8_t i;
+
+  for (i = 0; i < PORT_COUNT; i++)
+  {
+    threads[i] = NULL;
+    bench[i].port = &ports[i];
+    bench[i].duration = S2ST (seconds);
+    bench[i].transactions = 0;
+    bench[i].failed = 0;
+    if (!(mask & (1 << i))) continue;
+    threads[i] = chThdCreateFromHeap (NULL, THD_WORKING_AREA_SIZE(512), NORMALPRIO-1, benchThread, &bench[i]);
+    if (!threads[i]) chprintf (chp, "port %s: out of memory\r\n", ports[i].name);
+  }
+
+  for (i = 0; i < PORT_COUNT; i++)
+  {
+    if (!threads[i]) continue;
+    chThdWait (threads[i]);
+    total += bench[i].transactions;
+    chprintf (chp, "port %s: %u.%u/s, %u failed  ", ports[i].name,
+                  bench[i].transactions / seconds, bench[i].transactions * 10 / seconds % 10, bench[i].failed);
+  }
+  return total;
+}
+
+/*
+ * Monitor-side throughput, every port alone and then all ports at once.
+ * Ports overlap their transfers with the reply delays of the others, so
+ * the aggregate should approach the sum of the single-port rates.
+ */
+void port_benchmark (BaseSequentialStream *chp, uint32_t seconds)
+{
+  port_bench_t bench[PORT_COUNT];
+  uint32_t total;
+  uint8_t i;
+
+  for (i = 0; i < PORT_COUNT; i++)
+  {
+    port_bench_run (chp, bench, 1 << i, seconds);
+    chprintf (chp, "\r\n");
+  }
+
+  total = port_bench_run (chp, bench, (1 << PORT_COUNT) - 1, seconds);
+  chprintf (chp, "\r\naggregate: %u.%u/s\r\n", total / seconds, total * 10 / seconds % 10);
+}
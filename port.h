@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef PORT_H
+#define PORT_H
+
+#include "upstream.h"
+
+/*
+ * Host/monitor bus pairs, all on GPIOC: host SDA, host SCL, monitor SDA,
+ * monitor SCL. The host SDA pin doubles as EXTI line, so no two ports may
+ * share its number. Every port costs about 6 KB of RAM for its worker,
+ * reply cache and proxy thread, which is why only two are configured.
+ */
+#define PORT_TABLE(X) \
+    X(PORT_1, "1", 10, 11, 4, 5) \
+    X(PORT_2, "2",  0,  1, 2, 3)
+
+#define PORT_ID(id, name, host_sda, host_scl, monitor_sda, monitor_scl) id,
+
+typedef enum
+{
+    PORT_TABLE(PORT_ID)
+    PORT_COUNT
+} port_id_t;
+
+/* Longest the proxy may wake up after a START and still catch the address byte */
+#define PORT_START_LATENCY_US 8
+
+typedef struct port
+{
+    port_id_t id;
+    const char *name;
+    uint8_t host_sda;
+    uint8_t host_scl;
+    uint8_t monitor_sda;
+    uint8_t monitor_scl;
+
+    stats_t stats_host;
+    stats_t stats_monitor;
+    ddcci_timing_t timing;   /* monitor side, changed with its bus held */
+    upstream_t upstream;      /* worker for the monitor of this port */
+    upstream_t *engine;       /* worker serving the host of this port, another port's in KVM mode */
+
+    BBI2C_t host;                       /* slave towards the host, used by one thread at a time */
+    BBI2C_t monitor;                    /* master towards the monitor, used with its bus held */
+    uint8_t edid[EDID_LENGTH];          /* served to the host */
+
+    binary_semaphore_t start;  /* taken when the host sent a START */
+    volatile rtcnt_t startTime;
+    thread_t *proxy;
+    THD_WORKING_AREA(proxyWA, 1024);
+} port_t;
+
+extern port_t ports[PORT_COUNT];
+
+void port_init (void);
+BBI2C_t * port_monitor_bus (port_t *port, uint32_t frequency);
+void port_host_bus (port_t *port, BBI2C_t *dev, BBI2C_Mode_t mode);
+int port_wait_start (port_t *port);
+void port_benchmark (BaseSequentialStream *chp, uint32_t seconds);
+
+#endif // PORT_H
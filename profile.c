@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Per-monitor timing profiles. The monitor-side timing is swept one
+ * parameter at a time from the defaults towards faster settings until a
+ * setting fails, the fastest error-free settings are kept in flash keyed
+ * by the EDID vendor and product, and the proxy picks them up whenever
+ * it reads the EDID of a monitor.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "upstream.h"
+#include "port.h"
+#include "profile.h"
+
+#include "chprintf.h"
+
+#define PROFILE_MAGIC 0x50434444  /* "DDCP" */
+
+#define PROFILE_FLASH_KEY1 0x45670123
+#define PROFILE_FLASH_KEY2 0xCDEF89AB
+
+typedef struct
+{
+  uint32_t magic;  /* anything but PROFILE_MAGIC is an erased or foreign page */
+  uint32_t count;
+  uint32_t next;   /* replaced next when full */
+  profile_t entry[PROFILE_ENTRIES];
+} profile_store_t;
+
+typedef struct
+{
+  const char *name;
+  size_t offset;                /* of the uint32_t in ddcci_timing_t */
+  const uint32_t *candidates;   /* the default first, then ever faster */
+  uint8_t count;
+} profile_sweep_t;
+
+static const uint32_t replyDelays[] = {40, 30, 20, 15, 10, 5};
+static const uint32_t readRates[]   = {10000, 20000, 33000, 50000, 66000, 83000, 100000};
+static const uint32_t writeRates[]  = {50000, 66000, 83000, 100000};
+static const uint32_t byteGaps[]    = {5, 2, 1, 0};
+
+#define PROFILE_SWEEP(field, list) {#field, offsetof (ddcci_timing_t, field), list, sizeof(list) / sizeof(list[0])}
+
+/* the reply delay dominates a transaction, so it goes first */
+static const profile_sweep_t sweeps[] =
+{
+  PROFILE_SWEEP (reply_delay_ms, replyDelays),
+  PROFILE_SWEEP (read_frequency, readRates),
+  PROFILE_SWEEP (write_frequency, writeRates),
+  PROFILE_SWEEP (byte_gap_us, byteGaps)
+};
+
+static const profile_store_t * const flash = (const profile_store_t *)PROFILE_FLASH_ADDRESS;
+
+static profile_store_t store;  /* page image while updating */
+
+static uint8_t profile_valid (void)
+{
+  return flash->magic == PROFILE_MAGIC && flash->count <= PROFILE_ENTRIES && flash->next < PROFILE_ENTRIES;
+}
+
+static int profile_flash_wait (void)
+{
+  uint32_t sr;
+
+  while ((sr = FLASH->SR) & FLASH_SR_BSY);
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  return (sr & (FLASH_SR_PGERR | FLASH_SR_WRPERR)) ? -1 : 0;
+}
+
+/* erase the profile page and program 'len' bytes to it */
+static int profile_flash_write (const void *data, uint16_t len)
+{
+  const uint16_t *src = data;
+  volatile uint16_t *dst = (volatile uint16_t *)PROFILE_FLASH_ADDRESS;
+  uint16_t i;
+  int status;
+
+  /* a second key sequence while unlocked would lock the controller until reset */
+  if (FLASH->CR & FLASH_CR_LOCK)
+  {
+    FLASH->KEYR = PROFILE_FLASH_KEY1;
+    FLASH->KEYR = PROFILE_FLASH_KEY2;
+  }
+
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = PROFILE_FLASH_ADDRESS;
+  FLASH->CR |= FLASH_CR_STRT;
+  status = profile_flash_wait ();
+  FLASH->CR &= ~FLASH_CR_PER;
+
+  FLASH->CR |= FLASH_CR_PG;
+  for (i = 0; status == 0 && i < len / 2; i++)
+  {
+    dst[i] = src[i];
+    status = profile_flash_wait ();
+  }
+  FLASH->CR &= ~FLASH_CR_PG;
+  FLASH->CR |= FLASH_CR_LOCK;
+
+  return status;
+}
+
+static uint16_t profile_vendor (const uint8_t *edid)
+{
+  return (edid[8] << 8) | edid[9];
+}
+
+static uint16_t profile_product (const uint8_t *edid)
+{
+  return edid[10] | (edid[11] << 8);
+}
+
+static int profile_save (const ddcci_timing_t *timing, uint16_t vendor, uint16_t product, uint32_t samples)
+{
+  profile_t *entry = NULL;
+  uint32_t i;
+
+  if (profile_valid ()) store = *flash;
+  else
+  {
+    memset (&store, 0, sizeof(store));
+    store.magic = PROFILE_MAGIC;
+  }
+
+  for (i = 0; i < store.count; i++)
+  {
+    if (store.entry[i].vendor == vendor && store.entry[i].product == product) entry = &store.entry[i];
+  }
+  if (!entry && store.count < PROFILE_ENTRIES) entry = &store.entry[store.count++];
+  if (!entry)
+  {
+    entry = &store.entry[store.next];
+    store.next = (store.next + 1) % PROFILE_ENTRIES;
+  }
+
+  entry->vendor = vendor;
+  entry->product = product;
+  entry->samples = samples;
+  entry->timing = *timing;
+
+  return profile_flash_write (&store, sizeof(store));
+}
+
+/* one VCP brightness query, the code nearly every monitor implements */
+static int profile_trial (port_t *port)
+{
+  uint8_t request[6] = {0x6E, 0x51, 0x82, 0x01, 0x10};
+  uint8_t reply[DDCCI_FRAME_MAX];
+
+  ddcci_frame_seal (request);
+  if (ddcci_write_slave (port, request) < 0) return -1;
+  if (ddcci_read_slave (port, reply) < 0) return -1;
+  if (checkNullMessage (reply[1]) || reply[2] != 0x02) return -1;
+  return 0;
+}
+
+/* 0 if all 'samples' trials passed, -1 on the first failure, -2 on a key */
+static int profile_test (port_t *port, uint32_t samples)
+{
+  uint32_t i;
+
+  for (i = 0; i < samples; i++)
+  {
+    if (chnGetTimeout (&SDU1, TIME_IMMEDIATE) != Q_TIMEOUT) return -2;
+    if (profile_trial (port) < 0) return -1;
+  }
+  return 0;
+}
+
+static uint32_t *profile_value (port_t *port, const profile_sweep_t *sweep)
+{
+  return (uint32_t *)((uint8_t *)&port->timing + sweep->offset);
+}
+
+/* step the parameter swept last back to its previous candidate, NULL if all are at the defaults */
+static const profile_sweep_t *profile_back_off (port_t *port)
+{
+  const profile_sweep_t *sweep;
+  uint32_t *value;
+  uint8_t i, c;
+
+  for (i = sizeof(sweeps) / sizeof(sweeps[0]); i-- > 0;)
+  {
+    sweep = &sweeps[i];
+    value = profile_value (port, sweep);
+    for (c = 1; c < sweep->count; c++)
+    {
+      if (*value == sweep->candidates[c])
+      {
+        *value = sweep->candidates[c - 1];
+        return sweep;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void profile_print_timing (BaseSequentialStream *chp, const ddcci_timing_t *timing)
+{
+  chprintf (chp, "write %u Hz, read %u Hz, byte gap %u us, reply delay %u ms",
+            timing->write_frequency, timing->read_frequency, timing->byte_gap_us, timing->reply_delay_ms);
+}
+
+int profile_measure (BaseSequentialStream *chp, port_t *port, const uint8_t *edid, uint32_t samples)
+{
+  const ddcci_timing_t defaults = DDCCI_TIMING_DEFAULT;
+  const profile_sweep_t *sweep;
+  uint32_t *value;
+  uint8_t i, c, defaultsPassed;
+  int status;
+
+  upstream_acquire (&port->upstream);
+  port->timing = defaults;
+
+  chprintf (chp, "defaults: ");
+  status = profile_test (port, samples);
+  chprintf (chp, "%s\r\n", status == 0 ? "ok" : "failed");
+  defaultsPassed = (status == 0);
+
+  for (i = 0; status == 0 && i < sizeof(sweeps) / sizeof(sweeps[0]); i++)
+  {
+    sweep = &sweeps[i];
+    value = profile_value (port, sweep);
+    for (c = 1; c < sweep->count; c++)
+    {
+      *value = sweep->candidates[c];
+      chprintf (chp, "%s %u: ", sweep->name, *value);
+      status = profile_test (port, samples);
+      chprintf (chp, "%s\r\n", status == 0 ? "ok" : "failed");
+      if (status == 0) continue;
+
+      /* the previous candidate passed, keep it */
+      *value = sweep->candidates[c - 1];
+      if (status == -1) status = 0;
+      break;
+    }
+  }
+
+  /*
+   * Parameters were found one by one, make sure they also work together.
+   * If not, give up the fastest steps, most recently swept parameter first,
+   * until they do.
+   */
+  if (status == 0)
+  {
+    chprintf (chp, "combined: ");
+    status = profile_test (port, samples);
+    chprintf (chp, "%s\r\n", status == 0 ? "ok" : "failed");
+  }
+  while (defaultsPassed && status == -1 && (sweep = profile_back_off (port)) != NULL)
+  {
+    chprintf (chp, "combined, %s back to %u: ", sweep->name, *profile_value (port, sweep));
+    status = profile_test (port, samples);
+    chprintf (chp, "%s\r\n", status == 0 ? "ok" : "failed");
+  }
+  if (defaultsPassed && status == -1) status = -3;  /* the defaults passed before, now they did not */
+  if (status != 0) port->timing = defaults;
+  upstream_release (&port->upstream);
+
+  if (status != 0) return status;
+
+  profile_print_timing (chp, &port->timing);
+  chprintf (chp, "\r\nerror rate below %u.%u%% with 95%% confidence\r\n", 300 / samples, 3000 / samples % 10);
+  if (profile_save (&port->timing, profile_vendor (edid), profile_product (edid), samples) < 0)
+  {
+    chprintf (chp, "Saving profile failed\r\n");
+  }
+  return 0;
+}
+
+int profile_load (port_t *port, const uint8_t *edid)
+{
+  const ddcci_timing_t defaults = DDCCI_TIMING_DEFAULT;
+  const ddcci_timing_t *timing = &defaults;
+  uint32_t i;
+
+  if (profile_valid ())
+  {
+    for (i = 0; i < flash->count; i++)
+    {
+      if (flash->entry[i].vendor == profile_vendor (edid) && flash->entry[i].product == profile_product (edid))
+      {
+        timing = &flash->entry[i].timing;
+      }
+    }
+  }
+
+  upstream_acquire (&port->upstream);
+  port->timing = *timing;
+  upstream_release (&port->upstream);
+
+  return timing == &defaults ? -1 : 0;
+}
+
+void profile_clear (void)
+{
+  uint32_t empty = 0xFFFFFFFF;
+
+  profile_flash_write (&empty, sizeof(empty));
+}
+
+void profile_print (BaseSequentialStream *chp)
+{
+  uint32_t i;
+
+  for (i = 0; i < PORT_COUNT; i++)
+  {
+    chprintf (chp, "port %s: ", ports[i].name);
+    profile_print_timing (chp, &ports[i].timing);
+    chprintf (chp, "\r\n");
+  }
+
+  if (!profile_valid ()) return;
+  for (i = 0; i < flash->count; i++)
+  {
+    chprintf (chp, "%04x:%04x ", flash->entry[i].vendor, flash->entry[i].product);
+    profile_print_timing (chp, &flash->entry[i].timing);
+    chprintf (chp, ", %u samples\r\n", flash->entry[i].samples);
+  }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Monitors remembered, the oldest profile is replaced when full */
+#define PROFILE_ENTRIES 16
+
+/* Error-free transactions a setting must pass by default */
+#define PROFILE_SAMPLES 100
+
+/*
+ * Profiles live in the last 2 KB flash page of the STM32F303xC, far
+ * behind the image; the build fails should the image ever reach it.
+ * Erasing it stalls the CPU for up to 40 ms.
+ */
+#define PROFILE_FLASH_ADDRESS 0x0803F800
+#define PROFILE_FLASH_PAGE    2048
+
+typedef struct
+{
+    uint16_t vendor;   /* EDID manufacturer ID */
+    uint16_t product;  /* EDID product code */
+    uint32_t samples;  /* error-free transactions per setting when measured */
+    ddcci_timing_t timing;
+} profile_t;
+
+/*
+ * Sweep the monitor-side timing from the defaults towards faster
+ * settings, every setting has to pass 'samples' transactions. The
+ * result is stored for the monitor identified by 'edid'. Returns 0 on
+ * success, -1 if even the defaults failed, -2 if aborted by a key and -3
+ * if no combination passed, not even the defaults once more.
+ */
+int profile_measure (BaseSequentialStream *chp, struct port *port, const uint8_t *edid, uint32_t samples);
+
+/* use the stored timing for the monitor identified by 'edid' on 'port', or the defaults; 0 if found */
+int profile_load (struct port *port, const uint8_t *edid);
+
+void profile_clear (void);
+void profile_print (BaseSequentialStream *chp);
+
+#endif // PROFILE_H
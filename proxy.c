@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Host-facing side of the proxy, one thread per port. A thread sleeps
+ * until its host sends a START and follows the transfer byte by byte
+ * until the STOP. Requests go to the monitor-side worker of the port,
+ * replies are whatever the worker has for the latest request.
+ *
+ * Following a host transfer keeps the CPU busy, so only one host is
+ * served at a time. A host starting meanwhile gets no ACK for its
+ * address byte and retries, as DDC/CI hosts do for busy displays.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "attacks.h"
+#include "opcodes.h"
+#include "upstream.h"
+#include "port.h"
+#include "proxy.h"
+#include "profile.h"
+#include "log.h"
+#include "stats.h"
+#include "latency.h"
+#include "correlate.h"
+
+#define MASTER_EDID_REQUEST 0xA1
+#define MASTER_WRITE_REQUEST 0xA0
+#define MASTER_DDCCI_REQUEST 0x6E
+#define MASTER_DDCCI_ANSWER_REQUEST 0x6F
+#define MASTER_DDCCI_SOURCE_ADDRESS 0x51
+
+static uint8_t fakeEDID;
+static uint8_t running;
+
+/* first EDID request of the host: buy time with the dummy, then fetch the real one */
+static void proxy_first_edid (port_t *port)
+{
+  uint8_t *edid = port->edid;
+  int status;
+
+  write_edid (port, dummyEDID);
+  stats_inc (&port->stats_host, STATS_DUMMY_EDID);
+
+  /* in KVM mode only the first host to ask has the monitor read it */
+  status = upstream_edid (port->engine, edid);
+  if (status > 0 && profile_load (port->engine->port, edid) == 0)
+  { /* timing measured for this monitor before */
+    LOG_EVENT (LOG_PROXY_PROFILE, (edid[8] << 8) | edid[9], edid[10] | (edid[11] << 8));
+  }
+  if (fakeEDID) edid_monitor_string_faker (edid);
+}
+
+static THD_FUNCTION(proxyThread, arg)
+{
+  port_t *port = arg;
+  uint8_t data; /* captured Byte by Proxy */
+  uint8_t firstTime = 1;
+  uint8_t ddcci_request_length;
+  uint8_t *ddcRequest;
+  uint8_t answer[DDCCI_FRAME_MAX];
+  uint8_t answerLength;
+  signed int returncode;
+  rtcnt_t start;
+  rtcnt_t requestStart = 0; /* first time the host sent the pending request */
+  uint32_t sequence;
+  uint8_t opcode;
+  uint8_t pendingOpcode = 0;
+  uint8_t pending = 0; /* a reply is awaited */
+  uint8_t done;
+
+  chRegSetThreadName("proxy");
+
+  for (;;)
+  {
+    if (port_wait_start (port) < 0) continue;
+
+    /* one transfer, repeated STARTs included, until the host sends a STOP */
+    for (done = 0; !done && BBI2C_Receive_Byte (&port->host, &data) == 0; )
+    {
+      start = chSysGetRealtimeCounterX(); /* end of the address byte */
+      switch (data) /* Actions depending on captured byte */
+      {
+        case MASTER_EDID_REQUEST:
+          if (firstTime)
+          { /* to have enough time to get edid, send invalid edid */
+            proxy_first_edid (port);
+            firstTime = 0;
+            done = 1;
+          }
+          else if (write_edid (port, port->edid) != 0)
+          {
+            LOG_EVENT (LOG_PROXY_EDID_FAILED, 0, 0);
+          }
+          else /* EDID successfully sent to host */
+          {
+            stats_inc (&port->stats_host, STATS_EDID);
+            LOG_EVENT (LOG_PROXY_EDID_SENT, 0, 0);
+          }
+          break;
+
+        case MASTER_WRITE_REQUEST: /* EDID offset, the read follows after a repeated START */
+          break;
+
+        /* encountered a ddcci command */
+        case MASTER_DDCCI_REQUEST:
+          done = 1;
+          if (BBI2C_Receive_Byte (&port->host, &data) < 0 || data != MASTER_DDCCI_SOURCE_ADDRESS) break;
+          if (BBI2C_Receive_Byte (&port->host, &ddcci_request_length) < 0) break;
+          ddcRequest = ddcci_frame_alloc ();
+          if (!ddcRequest) break; /* all frames in flight, the host gets a NACK and retries */
+
+          if (ddcci_read_master (port, ddcci_request_length, ddcRequest) < 0) /* invalid request */
+          {
+            LOG_EVENT (LOG_PROXY_INVALID_REQUEST, 0, 0);
+            ddcci_frame_free (ddcRequest);
+            break;
+          }
+          stats_inc (&port->stats_host, STATS_REQUEST);
+
+          /* hand the frame as received to the monitor-side worker, the answer is fetched in parallel */
+          opcode = ddcRequest[3];
+          sequence = upstream_sequence (port->engine, port->id);
+          returncode = ddcci_dispatch (port, ddcRequest);
+          ddcci_frame_free (ddcRequest);
+          if (returncode < 0)
+          {
+            LOG_EVENT (LOG_PROXY_UNSUPPORTED, opcode, 0);
+            pending = 0;
+            break;
+          }
+
+          /* the worker ignores host retries of the same request, they count from its first attempt */
+          if (!pending || upstream_sequence (port->engine, port->id) != sequence)
+          {
+            requestStart = start;
+            pendingOpcode = opcode;
+            pending = 1;
+          }
+          correlate_request (upstream_sequence (port->engine, port->id), opcode,
+                             ddcci_opcodes[opcode].reply != DDCCI_REPLY_NONE, requestStart);
+          if (ddcci_opcodes[opcode].reply == DDCCI_REPLY_NONE)
+          { /* nothing to wait for, the request is done once it is queued */
+            latency_record (LATENCY_HOST, opcode, requestStart);
+            pending = 0;
+          }
+          break;
+
+        /* Master sent '6F' to read the answer */
+        case MASTER_DDCCI_ANSWER_REQUEST:
+          done = 1;
+          answerLength = upstream_reply (port->engine, port->id, answer);
+          if (answerLength)
+          {
+            if (pending)
+            {
+              latency_record (LATENCY_HOST, pendingOpcode, requestStart);
+              pending = 0;
+            }
+            correlate_reply (upstream_sequence (port->engine, port->id));
+            returncode = ddcci_write_master (port, answer, answerLength);
+            if (returncode >= 0) stats_inc (&port->stats_host, STATS_REPLY);
+            LOG_EVENT (LOG_PROXY_REPLY, returncode, 0);
+          }
+          else
+          { /* upstream busy, master retries */
+            stats_inc (&port->stats_host, STATS_NULL_MESSAGE);
+            correlate_null (upstream_sequence (port->engine, port->id));
+            if (ddcci_write_null_message (port) < 0) LOG_EVENT (LOG_PROXY_NULL_NACK, 0, 0);
+          }
+          break;
+
+        default:
+          break;
+      }
+    }
+  }
+}
+
+int proxy_start (uint8_t fake, uint8_t kvm)
+{
+  uint8_t i;
+
+  if (running) return -1;
+  running = 1;
+  fakeEDID = fake;
+
+  for (i = 0; i < PORT_COUNT; i++)
+  { /* in KVM mode all hosts talk to the monitor on port 1 */
+    if (kvm) ports[i].engine = &ports[PORT_1].upstream;
+  }
+
+  for (i = 0; i < PORT_COUNT; i++)
+  { /* above the workers and the shell, a START must be followed right away */
+    ports[i].proxy = chThdCreateStatic (ports[i].proxyWA, sizeof(ports[i].proxyWA), NORMALPRIO+1, proxyThread, &ports[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Passive bus sniffer. The lines of the selected buses are plain inputs
+ * sampled in a busy loop, transactions are decoded on the fly and queued
+ * as records (see sniffer.h), which go out over USB while the buses are
+ * idle. The sampling loop never blocks, a record that does not fit into
+ * the queue is dropped whole and accounted in the next one.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "capture.h"
+#include "sniffer.h"
+
+#define SNIFFER_IDLE_POLLS  1024  /* unchanged samples between housekeeping */
+#define SNIFFER_FLUSH_CHUNK 64    /* bytes handed to USB at once, bounds the sampling gap */
+#define SNIFFER_TIMEOUT_MS  100   /* a transaction without line changes is over */
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+#define SNIFFER_TIMEOUT (SNIFFER_TIMEOUT_MS * 1000 * CYCLES_PER_US)
+
+typedef struct
+{
+  uint8_t sda_pin;  /* both buses are wired to GPIOC */
+  uint8_t scl_pin;
+  uint8_t flag;     /* SNIFFER_MONITOR for the monitor-side bus */
+  i2c_decoder_t decoder;
+} sniffer_bus_t;
+
+static sniffer_bus_t buses[2] =
+{
+  {.sda_pin = 10, .scl_pin = 11, .flag = 0},
+  {.sda_pin = 4,  .scl_pin = 5,  .flag = SNIFFER_MONITOR}
+};
+
+static uint8_t  buffer[SNIFFER_BUFFER_SIZE];
+static uint16_t head;
+static uint16_t tail;
+static uint16_t fill;
+static uint16_t lost;
+
+/* microseconds since start, the cycle counter alone wraps after a minute */
+static uint32_t clockCycles;
+static uint32_t clockUs;
+
+/* transactions end after later edges of the other bus, so 'cycles' may lie slightly behind */
+static uint32_t sniffer_us (uint32_t cycles)
+{
+  int32_t elapsed = (int32_t)(cycles - clockCycles) / (int32_t)CYCLES_PER_US;
+
+  if (elapsed <= 0) return clockUs + elapsed;
+  clockCycles += elapsed * CYCLES_PER_US;
+  clockUs += elapsed;
+  return clockUs;
+}
+
+static void sniffer_queue (const uint8_t *data, uint16_t len)
+{
+  uint16_t first = SNIFFER_BUFFER_SIZE - head < len ? SNIFFER_BUFFER_SIZE - head : len;
+
+  memcpy (&buffer[head], data, first);
+  memcpy (buffer, data + first, len - first);
+  head = (head + len) % SNIFFER_BUFFER_SIZE;
+  fill += len;
+}
+
+/* hand queued bytes to USB without waiting, returns the number of bytes left */
+static uint16_t sniffer_flush (uint16_t max)
+{
+  uint16_t len = SNIFFER_BUFFER_SIZE - tail < fill ? SNIFFER_BUFFER_SIZE - tail : fill;
+
+  if (len > max) len = max;
+  if (len)
+  {
+    len = chnWriteTimeout (&SDU1, &buffer[tail], len, TIME_IMMEDIATE);
+    tail = (tail + len) % SNIFFER_BUFFER_SIZE;
+    fill -= len;
+  }
+  return fill;
+}
+
+/* decoder callback, queues the transaction as a record */
+static void sniffer_record (void *context, const i2c_transaction_t *t)
+{
+  sniffer_bus_t *bus = context;
+  sniffer_record_t record;
+  uint16_t ackBytes = (t->length + 8) / 8;
+
+  if (fill + sizeof(record) + t->length + ackBytes > SNIFFER_BUFFER_SIZE)
+  {
+    if (lost < 0xFFFF) lost++;
+    return;
+  }
+
+  record.sync     = SNIFFER_RECORD_SYNC;
+  record.flags    = t->flags | bus->flag;
+  record.address  = t->address;
+  record.length   = t->length;
+  record.lost     = lost;
+  record.start    = sniffer_us (t->start);
+  record.duration = (t->end - t->start) / CYCLES_PER_US;
+
+  sniffer_queue ((uint8_t *)&record, sizeof(record));
+  sniffer_queue (t->payload, t->length);
+  sniffer_queue (t->nack, ackBytes);
+  lost = 0;
+}
+
+static uint8_t sniffer_lines (sniffer_bus_t *bus, uint32_t port)
+{
+  return (((port >> bus->sda_pin) & 1) ? I2C_DECODE_SDA : 0) | (((port >> bus->scl_pin) & 1) ? I2C_DECODE_SCL : 0);
+}
+
+/* the lines are sampled by the CPU as fast as it goes */
+static void sniffer_poll (uint8_t selected, uint32_t mask)
+{
+  uint32_t port, sampled = mask, polls = 0;
+  uint8_t i, busy;
+  uint32_t t;
+
+  clockCycles = chSysGetRealtimeCounterX();
+
+  for (;;)
+  {
+    port = palReadPort (GPIOC) & mask;
+
+    if (port != sampled)
+    {
+      t = chSysGetRealtimeCounterX();
+      for (i = 0; i < 2; i++)
+      {
+        if (selected & (1 << i)) i2c_decode_edge (&buses[i].decoder, t, sniffer_lines (&buses[i], port));
+      }
+      sampled = port;
+      polls = 0;
+      continue;
+    }
+
+    if (++polls < SNIFFER_IDLE_POLLS) continue;
+    polls = 0;
+
+    t = chSysGetRealtimeCounterX();
+    busy = 0;
+    for (i = 0; i < 2; i++)
+    {
+      i2c_decode_timeout (&buses[i].decoder, t, SNIFFER_TIMEOUT);
+      busy |= buses[i].decoder.active;
+    }
+    if (busy) continue;
+
+    sniffer_us (t);
+    if (sniffer_flush (SNIFFER_FLUSH_CHUNK) == 0 && chnGetTimeout (&SDU1, TIME_IMMEDIATE) != Q_TIMEOUT) return;
+  }
+}
+
+/* the lines are sampled by DMA, the thread sleeps until edges are pending */
+static int sniffer_capture (uint8_t selected, uint32_t mask)
+{
+  capture_edge_t edges[16];
+  uint16_t n, e;
+  uint8_t i;
+
+  if (capture_start (mask, CAPTURE_RATE) < 0) return -1;
+  clockCycles = 0;
+
+  for (;;)
+  {
+    capture_wait (MS2ST (5));
+    while ((n = capture_read (edges, sizeof(edges) / sizeof(edges[0]))) > 0)
+    {
+      for (e = 0; e < n; e++)
+      {
+        for (i = 0; i < 2; i++)
+        {
+          if (selected & (1 << i)) i2c_decode_edge (&buses[i].decoder, edges[e].time, sniffer_lines (&buses[i], edges[e].port));
+        }
+      }
+    }
+
+    for (i = 0; i < 2; i++) i2c_decode_timeout (&buses[i].decoder, capture_time (), SNIFFER_TIMEOUT);
+    sniffer_us (capture_time ());
+    sniffer_flush (SNIFFER_BUFFER_SIZE);
+    if (chnGetTimeout (&SDU1, TIME_IMMEDIATE) != Q_TIMEOUT) break;
+  }
+
+  capture_stop ();
+  return capture_lost ();
+}
+
+/*
+ * Sniff the buses selected by SNIFFER_BUS_* until a character is received
+ * from the host. Both are sampled by the same port read, so their records
+ * share one timebase. Returns the number of edges the DMA capture lost, or
+ * -1 if it could not be started.
+ */
+int sniffer_run (uint8_t selected, uint8_t dma)
+{
+  uint32_t mask = 0;
+  uint8_t i;
+
+  for (i = 0; i < 2; i++)
+  {
+    i2c_decode_init (&buses[i].decoder, sniffer_record, &buses[i]);
+    if (!(selected & (1 << i))) continue;
+    palSetPadMode (GPIOC, buses[i].sda_pin, PAL_MODE_INPUT);
+    palSetPadMode (GPIOC, buses[i].scl_pin, PAL_MODE_INPUT);
+    mask |= (1 << buses[i].sda_pin) | (1 << buses[i].scl_pin);
+  }
+
+  head = tail = fill = 0;
+  lost = 0;
+  clockUs = 0;
+
+  if (dma) return sniffer_capture (selected, mask);
+  sniffer_poll (selected, mask);
+  return 0;
+}
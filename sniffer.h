@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include "i2cdecode.h"
+
+/* Longest payload kept per transaction, the rest is only counted */
+#define SNIFFER_PAYLOAD_MAX I2C_DECODE_PAYLOAD_MAX
+
+/* Records waiting for USB, a full buffer drops whole records */
+#define SNIFFER_BUFFER_SIZE 4096
+
+#define SNIFFER_RECORD_SYNC 0xC3
+
+/* record flags, the I2C_DECODE_* transaction flags plus the bus */
+#define SNIFFER_READ       I2C_DECODE_READ
+#define SNIFFER_STOP       I2C_DECODE_STOP
+#define SNIFFER_RESTART    I2C_DECODE_RESTART
+#define SNIFFER_TRUNCATED  I2C_DECODE_TRUNCATED
+#define SNIFFER_PARTIAL    I2C_DECODE_PARTIAL
+#define SNIFFER_MONITOR    0x20  /* seen on the monitor-side bus */
+
+/* buses for sniffer_run */
+#define SNIFFER_BUS_HOST    0x01
+#define SNIFFER_BUS_MONITOR 0x02
+
+/*
+ * One transaction from START to STOP or repeated START, little endian.
+ * It is followed by 'length' payload bytes and (length + 8) / 8 bytes
+ * of ACK pattern: bit i (LSB first) is set if byte i was NACKed, byte 0
+ * being the address.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t  sync;      /* SNIFFER_RECORD_SYNC */
+    uint8_t  flags;
+    uint8_t  address;   /* 7 bit address */
+    uint8_t  length;    /* payload bytes following the address */
+    uint16_t lost;      /* records dropped before this one */
+    uint32_t start;     /* microseconds since the sniffer started */
+    uint32_t duration;  /* microseconds from START to the end of the record */
+} sniffer_record_t;
+
+int sniffer_run (uint8_t buses, uint8_t dma);
+
+#endif // SNIFFER_H
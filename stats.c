@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "ch.h"
+#include "hal.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "port.h"
+
+#include "chprintf.h"
+
+#define STATS_COUNTER_NAME(id, name) [id] = name,
+
+static const char * const names[STATS_MAX] =
+{
+  STATS_COUNTERS(STATS_COUNTER_NAME)
+};
+
+#define STATS_BUSES (2 * PORT_COUNT)
+
+/* the host and monitor bus of every port, in port order */
+static stats_t * stats_bus (uint8_t bus)
+{
+  return (bus & 1) ? &ports[bus / 2].stats_monitor : &ports[bus / 2].stats_host;
+}
+
+void stats_reset (void)
+{
+  uint8_t bus, i;
+
+  for (bus = 0; bus < STATS_BUSES; bus++)
+  {
+    for (i = 0; i < STATS_MAX; i++)
+    {
+      __atomic_store_n (&stats_bus (bus)->counter[i], 0, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* the counters are sampled one by one, no lock is taken against the bus threads */
+void stats_print (BaseSequentialStream *chp, int machine)
+{
+  uint8_t bus, i;
+
+  if (!machine)
+  {
+    chprintf (chp, "%-10s", "");
+    for (bus = 0; bus < STATS_BUSES; bus++)
+    {
+      chprintf (chp, " %10s", stats_bus (bus)->name);
+    }
+    chprintf (chp, "\r\n");
+  }
+
+  for (i = 0; i < STATS_MAX; i++)
+  {
+    if (!machine) chprintf (chp, "%-10s", names[i]);
+    for (bus = 0; bus < STATS_BUSES; bus++)
+    {
+      if (machine)
+      {
+        chprintf (chp, "%s.%s=%u\r\n", stats_bus (bus)->name, names[i], stats_bus (bus)->counter[i]);
+      }
+      else
+      {
+        chprintf (chp, " %10u", stats_bus (bus)->counter[i]);
+      }
+    }
+    if (!machine) chprintf (chp, "\r\n");
+  }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+/* Protocol event counters kept for each bus */
+#define STATS_COUNTERS(X) \
+    X(STATS_REQUEST,      "request") \
+    X(STATS_REPLY,        "reply") \
+    X(STATS_NACK,         "nack") \
+    X(STATS_CHECKSUM,     "checksum") \
+    X(STATS_FRAME,        "frame") \
+    X(STATS_OPCODE,       "opcode") \
+    X(STATS_RETRY,        "retry") \
+    X(STATS_NULL_MESSAGE, "null") \
+    X(STATS_EDID,         "edid") \
+    X(STATS_DUMMY_EDID,   "dummyedid") \
+    X(STATS_CACHE_HIT,    "cachehit") \
+    X(STATS_CACHE_MISS,   "cachemiss") \
+    X(STATS_TIMEOUT,      "timeout") \
+    X(STATS_RECOVERY,     "recovery") \
+    X(STATS_STUCK,        "stuck") \
+    X(STATS_RECOVERY_US,  "recoveryus") \
+    X(STATS_MISSED,       "missed") \
+    X(STATS_MERGED,       "merged") \
+    X(STATS_DEADLINE,     "deadline") \
+    X(STATS_LATE_US,      "lateus") \
+    X(STATS_PREEMPTED,    "preempted") \
+    X(STATS_ABORTED,      "aborted")
+
+#define STATS_COUNTER_ID(id, name) id,
+
+typedef enum
+{
+    STATS_COUNTERS(STATS_COUNTER_ID)
+    STATS_MAX
+} stats_counter_t;
+
+typedef struct
+{
+    const char *name;
+    volatile uint32_t counter[STATS_MAX];
+} stats_t;
+
+/* safe from any thread, never blocks */
+static inline void stats_add (stats_t *stats, stats_counter_t counter, uint32_t value)
+{
+    __atomic_fetch_add (&stats->counter[counter], value, __ATOMIC_RELAXED);
+}
+
+static inline void stats_inc (stats_t *stats, stats_counter_t counter)
+{
+    stats_add (stats, counter, 1);
+}
+
+void stats_reset (void);
+void stats_print (BaseSequentialStream *chp, int machine);
+
+#endif // STATS_H
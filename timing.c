@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Bus timing measurements checked against the I2C specification. The
+ * host bus is sampled by the DMA capture while nothing is driving it
+ * from this side; the shortest SCL phase seen decides how often the
+ * software slave has to sample the lines to follow this host. The
+ * monitor-side master is measured with the cycle counter from within
+ * the bus code, so its own edges are timed to a few cycles.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "usbcfg.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "upstream.h"
+#include "port.h"
+#include "capture.h"
+#include "i2ctiming.h"
+#include "timing.h"
+
+#include "chprintf.h"
+
+#define TIMING_HOST_SDA (1 << 10)
+#define TIMING_HOST_SCL (1 << 11)
+#define TIMING_MONITOR_SDA_PIN 4
+#define TIMING_MONITOR_SCL_PIN 5
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+
+/* recorded times keep the lines in their two lowest bits */
+#define TIMING_RECORD_LINES (I2C_DECODE_SDA | I2C_DECODE_SCL)
+
+volatile uint8_t timing_recording;
+
+static i2c_timing_t analysis;
+static uint8_t  source;      /* TIMING_RECORD_* the analysis belongs to */
+static uint32_t nominal;     /* SCL frequency the master was set to, 0 if measured */
+static uint32_t lostEdges;
+
+static uint32_t record[TIMING_RECORD_EDGES];
+static uint16_t recorded;
+static uint8_t  recordLines;
+
+void timing_sample (int sda, int scl)
+{
+  uint8_t lines = (sda ? I2C_DECODE_SDA : 0) | (scl ? I2C_DECODE_SCL : 0);
+
+  if (lines == recordLines) return;
+  recordLines = lines;
+
+  if (recorded == TIMING_RECORD_EDGES)
+  {
+    lostEdges++;
+    return;
+  }
+  record[recorded++] = (chSysGetRealtimeCounterX() & ~TIMING_RECORD_LINES) | lines;
+}
+
+static void timing_flush (void)
+{
+  uint16_t i;
+
+  for (i = 0; i < recorded; i++)
+  {
+    i2c_timing_edge (&analysis, record[i] & ~TIMING_RECORD_LINES, record[i] & TIMING_RECORD_LINES);
+  }
+  recorded = 0;
+}
+
+static uint8_t timing_host_lines (uint16_t port)
+{
+  return ((port & TIMING_HOST_SDA) ? I2C_DECODE_SDA : 0) | ((port & TIMING_HOST_SCL) ? I2C_DECODE_SCL : 0);
+}
+
+int timing_measure (uint16_t transactions)
+{
+  capture_edge_t edges[16];
+  uint16_t n, e;
+
+  palSetPadMode (GPIOC, 10, PAL_MODE_INPUT);
+  palSetPadMode (GPIOC, 11, PAL_MODE_INPUT);
+  i2c_timing_init (&analysis, timing_host_lines (palReadPort (GPIOC)));
+  source = TIMING_RECORD_HOST;
+  nominal = 0;
+
+  if (capture_start (TIMING_HOST_SDA | TIMING_HOST_SCL, CAPTURE_RATE) < 0) return -1;
+
+  while (analysis.transactions < transactions && chnGetTimeout (&SDU1, TIME_IMMEDIATE) == Q_TIMEOUT)
+  {
+    capture_wait (MS2ST (5));
+    while ((n = capture_read (edges, sizeof(edges) / sizeof(edges[0]))) > 0)
+    {
+      for (e = 0; e < n; e++) i2c_timing_edge (&analysis, edges[e].time, timing_host_lines (edges[e].port));
+    }
+  }
+
+  capture_stop ();
+  lostEdges = capture_lost ();
+  return analysis.transactions;
+}
+
+int timing_master (uint32_t frequency)
+{
+  uint8_t request[6] = {0x6E, 0x51, 0x82, 0x01, 0x10};  /* VCP brightness query */
+  uint8_t reply[DDCCI_FRAME_MAX];
+  port_t *port = &ports[PORT_1];  /* the port the capture pins belong to */
+  ddcci_timing_t saved;
+  int status;
+
+  ddcci_frame_seal (request);
+  upstream_acquire (&port->upstream);
+  saved = port->timing;
+  port->timing.write_frequency = frequency;
+  port->timing.read_frequency = frequency;
+
+  recordLines = (palReadPad (GPIOC, TIMING_MONITOR_SDA_PIN) ? I2C_DECODE_SDA : 0) |
+                (palReadPad (GPIOC, TIMING_MONITOR_SCL_PIN) ? I2C_DECODE_SCL : 0);
+  i2c_timing_init (&analysis, recordLines);
+  source = TIMING_RECORD_MONITOR;
+  nominal = frequency;
+  recorded = 0;
+  lostEdges = 0;
+
+  /* the record only has room for one transfer, it is analyzed while the monitor prepares its reply */
+  timing_recording = TIMING_RECORD_MONITOR;
+  status = ddcci_write_slave (port, request);
+  timing_flush ();
+  if (status == 0) status = ddcci_read_slave (port, reply);
+  timing_recording = TIMING_RECORD_OFF;
+  timing_flush ();
+
+  port->timing = saved;
+  upstream_release (&port->upstream);
+
+  return status;
+}
+
+long timing_slave_delay (void)
+{
+  uint32_t high = analysis.stat[I2C_TIMING_SCL_HIGH].min;
+  uint32_t low = analysis.stat[I2C_TIMING_SCL_LOW].min;
+  long delay;
+
+  if (source != TIMING_RECORD_HOST) return -1;
+  if (analysis.stat[I2C_TIMING_SCL_HIGH].count == 0 || analysis.stat[I2C_TIMING_SCL_LOW].count == 0) return -1;
+
+  delay = (high < low ? high : low) / CYCLES_PER_US / TIMING_SAMPLES_PER_PHASE;
+  return delay < TIMING_DELAY_MAX ? delay : TIMING_DELAY_MAX;
+}
+
+/* cycles in tenths of a microsecond */
+static uint32_t timing_tenths (uint32_t cycles)
+{
+  return (uint64_t)cycles * 10 / CYCLES_PER_US;
+}
+
+/* SCL frequency for a period in cycles, in tenths of a kHz */
+static uint32_t timing_khz (uint32_t cycles)
+{
+  return cycles ? (STM32_HCLK / 100) / cycles : 0;
+}
+
+void timing_print (BaseSequentialStream *chp)
+{
+  const i2c_timing_stat_t *s;
+  uint32_t frequency, violations, avg, high, low, min, max;
+  uint8_t i;
+
+  if (!source) return;
+
+  frequency = nominal ? nominal : i2c_timing_frequency (&analysis, CYCLES_PER_US);
+  violations = i2c_timing_violations (&analysis, frequency, CYCLES_PER_US);
+
+  chprintf (chp, "%s bus, %u transactions, %u edges lost, resolution %u ns, %s mode limits\r\n",
+            source == TIMING_RECORD_HOST ? "host" : "monitor", analysis.transactions, lostEdges,
+            source == TIMING_RECORD_HOST ? (uint32_t)(1000000000 / CAPTURE_RATE) : 4000 / CYCLES_PER_US,
+            frequency > I2C_TIMING_STANDARD_MAX ? "fast" : "standard");
+  chprintf (chp, "%-12s %8s %8s %8s %8s %8s\r\n", "parameter", "count", "min/us", "avg/us", "max/us", "limit/us");
+  for (i = 0; i < I2C_TIMING_MAX; i++)
+  {
+    s = &analysis.stat[i];
+    avg = s->count ? s->sum / s->count : 0;
+    chprintf (chp, "%-12s %8u %6u.%u %6u.%u %6u.%u", i2c_timing_names[i], s->count,
+              timing_tenths (s->min) / 10, timing_tenths (s->min) % 10,
+              timing_tenths (avg) / 10, timing_tenths (avg) % 10,
+              timing_tenths (s->max) / 10, timing_tenths (s->max) % 10);
+
+    i2c_timing_limits (i, frequency, &min, &max);
+    if (max) chprintf (chp, "   <=%2u.%02u", max / 1000, max % 1000 / 10);
+    else if (min) chprintf (chp, "   >=%2u.%02u", min / 1000, min % 1000 / 10);
+    chprintf (chp, "%s\r\n", (violations & (1 << i)) ? " !" : "");
+  }
+
+  s = &analysis.stat[I2C_TIMING_SCL_PERIOD];
+  if (s->count == 0) return;
+
+  avg = s->sum / s->count;
+  high = analysis.stat[I2C_TIMING_SCL_HIGH].count ? analysis.stat[I2C_TIMING_SCL_HIGH].sum / analysis.stat[I2C_TIMING_SCL_HIGH].count : 0;
+  low = analysis.stat[I2C_TIMING_SCL_LOW].count ? analysis.stat[I2C_TIMING_SCL_LOW].sum / analysis.stat[I2C_TIMING_SCL_LOW].count : 0;
+  chprintf (chp, "SCL %u.%u kHz (%u.%u-%u.%u), duty cycle %u%%, %s\r\n",
+            timing_khz (avg) / 10, timing_khz (avg) % 10,
+            timing_khz (s->max) / 10, timing_khz (s->max) % 10,
+            timing_khz (s->min) / 10, timing_khz (s->min) % 10,
+            high + low ? high * 100 / (high + low) : 0,
+            violations ? "out of spec" : "within spec");
+}
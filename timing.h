@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef TIMING_H
+#define TIMING_H
+
+/* Slave samples per shortest SCL phase when choosing the sampling delay */
+#define TIMING_SAMPLES_PER_PHASE 3
+
+/* Longest sampling delay chosen, what BBI2C_Init gives a 50 kHz slave */
+#define TIMING_DELAY_MAX 5
+
+/* Line changes recorded with the cycle counter before they are analyzed */
+#define TIMING_RECORD_EDGES 512
+
+/* values of timing_recording */
+#define TIMING_RECORD_OFF     0
+#define TIMING_RECORD_HOST    1
+#define TIMING_RECORD_MONITOR 2
+
+extern volatile uint8_t timing_recording;
+
+void timing_sample (int sda, int scl);
+
+/* called by the bus code on every line access, only costs a test when idle */
+static inline void timing_lines (uint8_t bus, int sda, int scl)
+{
+    if (timing_recording == bus) timing_sample (sda, scl);
+}
+
+/*
+ * Passively observe the host bus until 'transactions' STOP conditions
+ * were seen or a character is received from the host. Returns the
+ * number of transactions measured or -1 if the capture is busy.
+ */
+int timing_measure (uint16_t transactions);
+
+/*
+ * Query the monitor once with the monitor-side bus clocked at
+ * 'frequency' and analyze the line changes the master code made and
+ * saw, timed by the cycle counter. Returns the status of the query.
+ */
+int timing_master (uint32_t frequency);
+
+/* sampling delay for BBI2C slaves derived from the last host measurement, -1 if none */
+long timing_slave_delay (void);
+
+/* results of the last measurement checked against the limits for its SCL frequency */
+void timing_print (BaseSequentialStream *chp);
+
+#endif // TIMING_H
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Host-side timing simulation of the bit-banged I2C code. bbi2c.c is
+ * built against stand-in ChibiOS headers; every port access and cycle
+ * counter read costs simulated CPU cycles, and the other end of the bus
+ * is modelled: a slave that stretches the clock once for the master
+ * code, a scripted master for the slave code. The resulting waveform is
+ * checked by the same analysis as on target (i2ctiming.c). Further tests
+ * leave the bus stuck and check it is recovered in time, and that a Get
+ * VCP at the default monitor timing fits the time the request scheduler
+ * allows for it.
+ *
+ * The nop loop of the slave sampling delay is not simulated, the slave
+ * runs with the delay of 0 the timing command picks for Fast-mode hosts.
+ *
+ * Build: cc -O2 -Istubs -I.. -o bbi2csim/bbi2csim bbi2csim/bbi2csim.c ../bbi2c.c ../i2ctiming.c
+ * Usage: bbi2csim/bbi2csim [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "bbi2c.h"
+#include "trace.h"
+#include "timing.h"
+#include "i2ctiming.h"
+#include "stats.h"
+#include "log.h"
+#include "ddcci.h"
+
+#define SIM_SDA    0  /* pin numbers on the simulated port */
+#define SIM_SCL    1
+#define SIM_SAMPLE 2  /* scripted master samples SDA */
+
+#define SIM_PORT_CYCLES    6   /* one GPIO register access */
+#define SIM_COUNTER_CYCLES 3   /* reading the cycle counter */
+#define SIM_LIMIT          (STM32_HCLK / 10)  /* 100 ms, the bus code hangs */
+#define SIM_ACTIONS        1024
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+#define NS(ns) ((ns) * CYCLES_PER_US / 1000)
+
+typedef struct
+{
+  uint32_t time;
+  uint8_t  what;   /* SIM_SDA, SIM_SCL or SIM_SAMPLE */
+  uint8_t  level;
+} sim_action_t;
+
+/* the bus code only records into these when asked to */
+volatile uint8_t trace_recording;
+volatile uint8_t timing_recording;
+void trace_sample (trace_bus_t bus, int sda, int scl) { (void)bus; (void)sda; (void)scl; }
+void timing_sample (int sda, int scl) { (void)sda; (void)scl; }
+void log_event (log_message_t message, uint32_t a, uint32_t b) { (void)message; (void)a; (void)b; }
+
+static stats_t stats = {"sim", {0}};  /* counters of the bus under test */
+
+static stm32_gpio_t port;
+static uint32_t now;
+static uint8_t  dut[2];   /* lines released by the code under test */
+static uint8_t  peer[2];  /* lines released by the modelled other end */
+static uint8_t  bus;      /* I2C_DECODE_SDA/I2C_DECODE_SCL */
+static i2c_timing_t analysis;
+static int verbose;
+
+static sim_action_t actions[SIM_ACTIONS];
+static int head, count;
+
+static void (*peer_edge) (uint8_t old, uint8_t lines);
+
+static uint8_t sampled[64];  /* bits the scripted master saw */
+static int samples;
+
+static void sim_schedule (uint32_t time, uint8_t what, uint8_t level)
+{
+  int i;
+
+  if (count == SIM_ACTIONS)
+  {
+    fprintf (stderr, "too many actions\n");
+    exit (2);
+  }
+  for (i = count; i > head && actions[i - 1].time > time; i--) actions[i] = actions[i - 1];
+  actions[i].time = time;
+  actions[i].what = what;
+  actions[i].level = level;
+  count++;
+}
+
+static void sim_update (void)
+{
+  uint8_t lines, old;
+
+  for (;;)
+  {
+    lines = ((dut[SIM_SDA] && peer[SIM_SDA]) ? I2C_DECODE_SDA : 0) | ((dut[SIM_SCL] && peer[SIM_SCL]) ? I2C_DECODE_SCL : 0);
+    if (lines == bus) return;
+    old = bus;
+    bus = lines;
+    if (verbose) printf ("%8u %u %u\n", now, (lines & I2C_DECODE_SDA) ? 1 : 0, (lines & I2C_DECODE_SCL) ? 1 : 0);
+    i2c_timing_edge (&analysis, now, lines);
+    if (peer_edge) peer_edge (old, lines);
+  }
+}
+
+/* let the modelled end act until 'cycles' from now */
+static void sim_advance (uint32_t cycles)
+{
+  uint32_t target = now + cycles;
+  sim_action_t *a;
+
+  while (head < count && actions[head].time <= target)
+  {
+    a = &actions[head++];
+    if (a->time > now) now = a->time;
+    if (a->what == SIM_SAMPLE) sampled[samples++ % sizeof(sampled)] = (bus & I2C_DECODE_SDA) ? 1 : 0;
+    else peer[a->what] = a->level;
+    sim_update ();
+  }
+  now = target;
+
+  if (now > SIM_LIMIT)
+  {
+    fprintf (stderr, "bus code hangs\n");
+    exit (2);
+  }
+}
+
+rtcnt_t chSysGetRealtimeCounterX (void)
+{
+  sim_advance (SIM_COUNTER_CYCLES);
+  return now;
+}
+
+uint32_t palReadPad (stm32_gpio_t *p, int pin)
+{
+  (void)p;
+  sim_advance (SIM_PORT_CYCLES);
+  return (bus & (pin == SIM_SDA ? I2C_DECODE_SDA : I2C_DECODE_SCL)) ? 1 : 0;
+}
+
+void palSetPad (stm32_gpio_t *p, int pin)
+{
+  (void)p;
+  sim_advance (SIM_PORT_CYCLES);
+  dut[pin] = 1;
+  sim_update ();
+}
+
+void palClearPad (stm32_gpio_t *p, int pin)
+{
+  (void)p;
+  sim_advance (SIM_PORT_CYCLES);
+  dut[pin] = 0;
+  sim_update ();
+}
+
+void palSetPadMode (stm32_gpio_t *p, int pin, int mode)
+{
+  (void)p;
+  (void)pin;
+  (void)mode;
+}
+
+static void sim_reset (void (*edge) (uint8_t old, uint8_t lines))
+{
+  now = 0;
+  head = count = 0;
+  samples = 0;
+  dut[SIM_SDA] = dut[SIM_SCL] = 1;
+  peer[SIM_SDA] = peer[SIM_SCL] = 1;
+  bus = I2C_DECODE_SDA | I2C_DECODE_SCL;
+  peer_edge = edge;
+  memset ((void *)stats.counter, 0, sizeof(stats.counter));
+  i2c_timing_init (&analysis, bus);
+}
+
+static void sim_finish (void)
+{
+  while (head < count) sim_advance (SIM_PORT_CYCLES);
+}
+
+static int sim_report (const char *name, uint32_t frequency)
+{
+  const i2c_timing_stat_t *s;
+  uint32_t violations = i2c_timing_violations (&analysis, frequency, CYCLES_PER_US);
+  uint32_t min, max;
+  int i;
+
+  printf ("%s at %u Hz: SCL %u Hz, %s\n", name, frequency, i2c_timing_frequency (&analysis, CYCLES_PER_US),
+          violations ? "FAIL" : "ok");
+  for (i = 0; i < I2C_TIMING_MAX; i++)
+  {
+    s = &analysis.stat[i];
+    if (s->count == 0) continue;
+    i2c_timing_limits (i, frequency, &min, &max);
+    printf ("  %-12s %4u %7u %7u ns", i2c_timing_names[i], s->count,
+            s->min * 1000 / CYCLES_PER_US, s->max * 1000 / CYCLES_PER_US);
+    if (max) printf ("  <= %u", max);
+    else if (min) printf ("  >= %u", min);
+    printf ("%s\n", (violations & (1 << i)) ? "  !" : "");
+  }
+  return violations ? -1 : 0;
+}
+
+/*
+ * Slave model for the master code: acknowledges everything, answers
+ * reads with slave_data(), sets SDA 300 ns after SCL fell and stretches
+ * the clock after the first ACK.
+ */
+static struct
+{
+  int active, clocks, byte, read, shift, nack;
+} slave;
+
+static int slave_stuck;  /* clocks until a slave left in the middle of a byte lets go of SDA */
+
+static uint8_t slave_data (int byte)
+{
+  return 0xA5 + byte * 0x11;
+}
+
+static void slave_edge (uint8_t old, uint8_t lines)
+{
+  uint32_t hold = now + NS(300);
+
+  if (slave_stuck)
+  {
+    if (!(old & I2C_DECODE_SCL) && (lines & I2C_DECODE_SCL) && --slave_stuck == 0) sim_schedule (hold, SIM_SDA, 1);
+    return;
+  }
+  if ((old & lines & I2C_DECODE_SCL) && ((old ^ lines) & I2C_DECODE_SDA))
+  { /* START or STOP */
+    memset (&slave, 0, sizeof(slave));
+    slave.active = !(lines & I2C_DECODE_SDA);
+    return;
+  }
+  if (!slave.active) return;
+
+  if (lines & I2C_DECODE_SCL)
+  {
+    if (old & I2C_DECODE_SCL) return;
+    slave.clocks++;
+    if (slave.clocks <= 8 && (slave.byte == 0 || !slave.read)) slave.shift = (slave.shift << 1) | ((lines & I2C_DECODE_SDA) ? 1 : 0);
+    if (slave.clocks == 9 && slave.byte > 0 && slave.read) slave.nack = (lines & I2C_DECODE_SDA) ? 1 : 0;
+    return;
+  }
+  if (!(old & I2C_DECODE_SCL)) return;
+
+  if (slave.clocks == 8)
+  {
+    if (slave.byte == 0) slave.read = slave.shift & 1;
+    sim_schedule (hold, SIM_SDA, (slave.byte == 0 || !slave.read) ? 0 : 1);
+  }
+  else if (slave.clocks == 9)
+  {
+    slave.clocks = 0;
+    slave.byte++;
+    sim_schedule (hold, SIM_SDA, (slave.read && !slave.nack) ? slave_data (slave.byte) >> 7 : 1);
+    if (slave.byte == 1)
+    {
+      peer[SIM_SCL] = 0;
+      sim_schedule (now + NS(2000), SIM_SCL, 1);
+    }
+  }
+  else if (slave.read && slave.byte > 0)
+  {
+    sim_schedule (hold, SIM_SDA, (slave_data (slave.byte) >> (7 - slave.clocks)) & 1);
+  }
+}
+
+/* a DDC/CI request, then a register read with repeated START as for EDID */
+static int test_master (uint32_t frequency)
+{
+  const uint8_t request[] = {0x6E, 0x51, 0x82, 0x01, 0x10, 0xAC};
+  static BBI2C_t dev;  /* set up once and retimed, like the monitor bus of a port */
+  uint8_t data;
+  int i, errors = 0;
+
+  sim_reset (slave_edge);
+  if (!dev.frequency)
+  {
+    BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, frequency, BBI2C_MODE_MASTER);
+    dev.stats = &stats;
+  }
+  BBI2C_Set_Frequency (&dev, frequency);
+  dev.scl_edge = now;  /* the simulated clock starts over */
+
+  BBI2C_Start (&dev);
+  for (i = 0; i < (int)sizeof(request); i++) errors += !BBI2C_Send_Byte (&dev, request[i]);
+  BBI2C_Stop (&dev);
+
+  BBI2C_Start (&dev);
+  errors += !BBI2C_Send_Byte (&dev, 0xA0);
+  errors += !BBI2C_Send_Byte (&dev, 0x00);
+  BBI2C_Start (&dev);
+  errors += !BBI2C_Send_Byte (&dev, 0xA1);
+  for (i = 1; i <= 4; i++)
+  {
+    BBI2C_Recv_Byte (&dev, &data);
+    errors += data != slave_data (i);
+    if (i < 4) BBI2C_Ack (&dev);
+    else BBI2C_NACK (&dev);
+  }
+  BBI2C_Stop (&dev);
+  sim_finish ();
+
+  if (errors) printf ("master: %d transfer errors\n", errors);
+  return sim_report ("master", frequency) < 0 || errors ? -1 : 0;
+}
+
+/* scripted master clocking SCL at 'frequency' with 60% low time */
+static uint32_t script_time, script_low, script_high;
+
+static void script_bit (int level)
+{
+  sim_schedule (script_time + NS(200), SIM_SDA, level);
+  sim_schedule (script_time + script_low, SIM_SCL, 1);
+  sim_schedule (script_time + script_low + script_high / 2, SIM_SAMPLE, 0);
+  sim_schedule (script_time + script_low + script_high, SIM_SCL, 0);
+  script_time += script_low + script_high;
+}
+
+/* the master reads 'n' bytes from address 0x50 */
+static void script_read (uint32_t frequency, int n)
+{
+  int i, b;
+
+  script_low = STM32_HCLK / frequency * 6 / 10;
+  script_high = STM32_HCLK / frequency - script_low;
+  script_time = NS(2000);
+
+  sim_schedule (script_time, SIM_SDA, 0);
+  script_time += script_high;
+  sim_schedule (script_time, SIM_SCL, 0);
+
+  for (b = 7; b >= 0; b--) script_bit ((0xA1 >> b) & 1);
+  script_bit (1);
+  for (i = 0; i < n; i++)
+  {
+    for (b = 0; b < 8; b++) script_bit (1);
+    script_bit (i == n - 1);
+  }
+
+  sim_schedule (script_time + NS(200), SIM_SDA, 0);
+  sim_schedule (script_time + script_low, SIM_SCL, 1);
+  sim_schedule (script_time + script_low + script_high, SIM_SDA, 1);
+}
+
+/* the slave answers a read the way the proxy serves EDID and DDC/CI replies */
+static int test_slave (uint32_t frequency)
+{
+  const uint8_t reply[] = {0x6E, 0x88, 0x02, 0x00};
+  BBI2C_t dev;
+  uint8_t data = 0;
+  int i, b, status, errors = 0;
+
+  sim_reset (NULL);
+  script_read (frequency, sizeof(reply));
+  BBI2C_Set_Slave_Delay (0);
+  BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, frequency, BBI2C_MODE_SLAVE);
+  dev.stats = &stats;
+
+  errors += BBI2C_Get_Byte (&dev) != 0xA1;
+  for (i = 0; i < (int)sizeof(reply); i++)
+  {
+    status = BBI2C_Send_Byte_To_Master (&dev, reply[i]);
+    errors += status != (i == (int)sizeof(reply) - 1);
+  }
+  sim_finish ();
+
+  /* what the master saw: address ACK, then 8 data bits and its own ACK per byte */
+  errors += sampled[8] != 0;
+  for (i = 0; i < (int)sizeof(reply); i++)
+  {
+    for (b = 0; b < 8; b++) data = (data << 1) | sampled[9 + i * 9 + b];
+    errors += data != reply[i];
+  }
+
+  if (errors) printf ("slave: %d transfer errors\n", errors);
+  return sim_report ("slave", frequency) < 0 || errors ? -1 : 0;
+}
+
+/* a slave that lost track of a transfer holds SDA, the next START clocks it free */
+static int test_stuck_sda (uint32_t frequency)
+{
+  const uint8_t request[] = {0x6E, 0x51, 0x82, 0x01, 0x10, 0xAC};
+  BBI2C_t dev;
+  int i, errors = 0;
+
+  sim_reset (slave_edge);
+  slave_stuck = 5;
+  peer[SIM_SDA] = 0;
+  sim_update ();
+  BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, frequency, BBI2C_MODE_MASTER);
+  dev.stats = &stats;
+
+  BBI2C_Start (&dev);
+  for (i = 0; i < (int)sizeof(request); i++) errors += !BBI2C_Send_Byte (&dev, request[i]);
+  BBI2C_Stop (&dev);
+  sim_finish ();
+
+  errors += dev.error != 0 || stats.counter[STATS_RECOVERY] != 1;
+  printf ("stuck SDA at %u Hz: recovered in %u us, %s\n", frequency, stats.counter[STATS_RECOVERY_US],
+          errors ? "FAIL" : "ok");
+  return errors ? -1 : 0;
+}
+
+/* a slave holding SCL for good must not hang the master */
+static int test_stuck_scl (uint32_t frequency)
+{
+  BBI2C_t dev;
+  int errors = 0;
+
+  sim_reset (NULL);
+  peer[SIM_SCL] = 0;
+  BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, frequency, BBI2C_MODE_MASTER);
+  dev.stats = &stats;
+
+  BBI2C_Start (&dev);
+  errors += BBI2C_Send_Byte (&dev, 0x6E) != 0;
+  BBI2C_Stop (&dev);
+
+  errors += !dev.error || stats.counter[STATS_TIMEOUT] != 1 || stats.counter[STATS_STUCK] != 1;
+  errors += now > 2 * BBI2C_STRETCH_TIMEOUT_US * CYCLES_PER_US + NS(100000);
+  printf ("stuck SCL at %u Hz: gave up after %u us, %s\n", frequency, now / CYCLES_PER_US, errors ? "FAIL" : "ok");
+  return errors ? -1 : 0;
+}
+
+/* the host stops clocking in the middle of a reply, the slave must let go of SDA */
+static int test_host_stall (uint32_t frequency)
+{
+  BBI2C_t dev;
+  int b, status, errors = 0;
+
+  sim_reset (NULL);
+  script_low = STM32_HCLK / frequency * 6 / 10;
+  script_high = STM32_HCLK / frequency - script_low;
+  script_time = NS(2000);
+  sim_schedule (script_time, SIM_SDA, 0);
+  script_time += script_high;
+  sim_schedule (script_time, SIM_SCL, 0);
+  for (b = 7; b >= 0; b--) script_bit ((0xA1 >> b) & 1);
+  script_bit (1);
+
+  BBI2C_Set_Slave_Delay (0);
+  BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, frequency, BBI2C_MODE_SLAVE);
+  dev.stats = &stats;
+
+  errors += BBI2C_Get_Byte (&dev) != 0xA1;
+  status = BBI2C_Send_Byte_To_Master (&dev, 0x00);
+  errors += status != BBI2C_TIMEOUT || !(bus & I2C_DECODE_SDA) || stats.counter[STATS_TIMEOUT] != 1;
+
+  printf ("host stall at %u Hz: SDA released after %u us, %s\n", frequency, now / CYCLES_PER_US, errors ? "FAIL" : "ok");
+  return errors ? -1 : 0;
+}
+
+/*
+ * A Get VCP request and the largest reply at the default monitor timing,
+ * without any other job in the way, must not count as late: bus time plus
+ * reply delay and byte gaps stays within ddcci_transaction_us.
+ */
+static int test_transaction (void)
+{
+  const ddcci_timing_t timing = DDCCI_TIMING_DEFAULT;
+  const uint8_t request[] = {0x6E, 0x51, 0x82, 0x01, 0x10, 0xAC};
+  const int replyBytes = DDCCI_REPLY_PAYLOAD_MAX + 3;
+  BBI2C_t dev;
+  uint32_t write, read, us, limit;
+  uint8_t data;
+  int i, errors = 0;
+
+  sim_reset (slave_edge);
+  BBI2C_Init (&dev, &port, SIM_SDA, &port, SIM_SCL, timing.write_frequency, BBI2C_MODE_MASTER);
+  dev.stats = &stats;
+  BBI2C_Start (&dev);
+  for (i = 0; i < (int)sizeof(request); i++) errors += !BBI2C_Send_Byte (&dev, request[i]);
+  BBI2C_Stop (&dev);
+  sim_finish ();
+  write = now;
+
+  sim_reset (slave_edge);
+  BBI2C_Set_Frequency (&dev, timing.read_frequency);
+  dev.scl_edge = now;
+  BBI2C_Start (&dev);
+  errors += !BBI2C_Send_Byte (&dev, 0x6F);
+  for (i = 0; i < replyBytes; i++)
+  {
+    BBI2C_Recv_Byte (&dev, &data);
+    if (i < replyBytes - 1) BBI2C_Ack (&dev);
+    else BBI2C_NACK (&dev);
+  }
+  BBI2C_Stop (&dev);
+  sim_finish ();
+  read = now;
+
+  us = (write + read) / CYCLES_PER_US + timing.reply_delay_ms * 1000 + (replyBytes + 1) * timing.byte_gap_us;
+  limit = ddcci_transaction_us (&timing, sizeof(request), 1);
+  if (us > limit) errors++;
+  printf ("getvcp at default timing: %u us, %u us allowed, %s\n", us, limit, errors ? "FAIL" : "ok");
+  return errors ? -1 : 0;
+}
+
+int main (int argc, char *argv[])
+{
+  const uint32_t frequencies[] = {100000, 400000};
+  unsigned i;
+  int failed = 0;
+
+  verbose = argc > 1 && strcmp (argv[1], "-v") == 0;
+
+  for (i = 0; i < sizeof(frequencies) / sizeof(frequencies[0]); i++)
+  {
+    failed |= test_master (frequencies[i]);
+    failed |= test_slave (frequencies[i]);
+    failed |= test_stuck_sda (frequencies[i]);
+    failed |= test_stuck_scl (frequencies[i]);
+    failed |= test_host_stall (frequencies[i]);
+  }
+  failed |= test_transaction ();
+  return failed ? 1 : 0;
+}
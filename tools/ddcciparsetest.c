@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+/*
+ * Host-side property tests of the streaming DDC/CI frame parser
+ * (ddcciparse.c). Random byte streams, valid frames and valid frames with
+ * one bit flipped are fed byte by byte and the verdict is compared with a
+ * whole-frame check written down from the DDC/CI rules, the way frames
+ * used to be checked after the last byte. Checked properties:
+ *
+ *  - the verdict and the byte it is reached at match the reference, so
+ *    garbage is refused at the first byte that makes it impossible
+ *  - every valid frame is accepted exactly at its checksum byte
+ *  - a valid frame with a flipped bit outside the length is never accepted
+ *  - a verdict is final, later bytes neither change it nor the frame
+ *  - nothing is written beyond the frame, whatever the stream
+ *
+ * Build: cc -O2 -I.. -o ddcciparsetest ddcciparsetest.c ../ddcciparse.c
+ * Usage: ddcciparsetest [-n iterations] [-s seed] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ddcciparse.h"
+#include "opcodes.h"
+
+#define TEST_STREAM_MAX 64  /* longer than any frame, the parser must stop on its own */
+#define TEST_GUARD      16  /* bytes after the frame buffer that must stay untouched */
+#define TEST_GUARD_BYTE 0xA5
+
+typedef enum
+{
+    TEST_RANDOM,   /* uniform random bytes */
+    TEST_HEADER,   /* valid header, random rest */
+    TEST_VALID,    /* complete valid frame, random trailing bytes */
+    TEST_FLIPPED,  /* valid frame with one bit flipped outside the length byte */
+    TEST_MODES
+} test_mode_t;
+
+static const char *test_mode_names[TEST_MODES] = {"random", "header", "valid", "flipped"};
+
+static const char *status_names[] =
+{
+    "more", "done", "bad-header", "bad-length", "bad-opcode", "bad-checksum"
+};
+
+static int verbose;
+static uint32_t rng;
+
+/* xorshift32, runs are reproducible from the seed */
+static uint32_t test_random (void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint8_t known_request (uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case DDCCI_OP_GET_VCP:
+        case DDCCI_OP_SET_VCP:
+        case DDCCI_OP_TIMING_REPORT:
+        case DDCCI_OP_SAVE_SETTINGS:
+        case DDCCI_OP_TABLE_READ:
+        case DDCCI_OP_TABLE_WRITE:
+        case DDCCI_OP_IDENTIFICATION:
+        case DDCCI_OP_CAPABILITIES:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t known_reply (uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case DDCCI_OP_GET_VCP_REPLY:
+        case DDCCI_OP_TIMING_REPLY:
+        case DDCCI_OP_IDENTIFICATION_REPLY:
+        case DDCCI_OP_CAPABILITIES_REPLY:
+        case DDCCI_OP_TABLE_READ_REPLY:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Verdict on a whole stream by the DDC/CI rules, with the index of the
+ * byte it is reached at. Request checksums cover all bytes from the 6E
+ * destination, reply checksums start from 6F and 51 and skip the 6E.
+ */
+static ddcci_parse_status_t reference (ddcci_parse_kind_t kind, ddcci_parse_known_t known,
+                                       const uint8_t *s, int len, int *at)
+{
+    int header = (kind == DDCCI_PARSE_REQUEST) ? 3 : 2;
+    int max = (kind == DDCCI_PARSE_REQUEST) ? DDCCI_PAYLOAD_MAX : DDCCI_REPLY_PAYLOAD_MAX;
+    int payload, end, i;
+    uint8_t chk;
+
+    *at = len;
+    if (len < 1) return DDCCI_PARSE_MORE;
+    *at = 0;
+    if (s[0] != 0x6E) return DDCCI_PARSE_BAD_HEADER;
+    if (kind == DDCCI_PARSE_REQUEST)
+    {
+        *at = len;
+        if (len < 2) return DDCCI_PARSE_MORE;
+        *at = 1;
+        if (s[1] != 0x51) return DDCCI_PARSE_BAD_HEADER;
+    }
+
+    *at = len;
+    if (len < header) return DDCCI_PARSE_MORE;
+    *at = header - 1;
+    payload = s[header - 1] & 0x7F;
+    if (!(s[header - 1] & 0x80) || payload > max) return DDCCI_PARSE_BAD_LENGTH;
+    if (kind == DDCCI_PARSE_REQUEST && payload == 0) return DDCCI_PARSE_BAD_LENGTH;
+
+    if (payload > 0)
+    {
+        *at = len;
+        if (len <= header) return DDCCI_PARSE_MORE;
+        *at = header;
+        if (known && !known (s[header])) return DDCCI_PARSE_BAD_OPCODE;
+    }
+
+    end = header + payload;
+    *at = len;
+    if (len <= end) return DDCCI_PARSE_MORE;
+    *at = end;
+    if (kind == DDCCI_PARSE_REQUEST)
+    {
+        for (chk = 0, i = 0; i < end; i++) chk ^= s[i];
+    }
+    else
+    {
+        for (chk = 0x6F ^ 0x51, i = 1; i < end; i++) chk ^= s[i];
+    }
+    return (chk == s[end]) ? DDCCI_PARSE_DONE : DDCCI_PARSE_BAD_CHECKSUM;
+}
+
+/* a valid frame of 'kind' followed by random bytes, returns the frame length */
+static int make_frame (ddcci_parse_kind_t kind, ddcci_parse_known_t known, uint8_t *s)
+{
+    int header = (kind == DDCCI_PARSE_REQUEST) ? 3 : 2;
+    int max = (kind == DDCCI_PARSE_REQUEST) ? DDCCI_PAYLOAD_MAX : DDCCI_REPLY_PAYLOAD_MAX;
+    int payload, i;
+    uint8_t chk;
+
+    for (i = 0; i < TEST_STREAM_MAX; i++) s[i] = test_random ();
+
+    s[0] = 0x6E;
+    if (kind == DDCCI_PARSE_REQUEST) s[1] = 0x51;
+    payload = test_random () % (max + 1);
+    if (kind == DDCCI_PARSE_REQUEST && payload == 0) payload = 1;
+    s[header - 1] = 0x80 | payload;
+    if (payload > 0)
+    {
+        while (known && !known (s[header])) s[header] = test_random ();
+    }
+
+    chk = (kind == DDCCI_PARSE_REQUEST) ? 0 : 0x50;
+    for (i = 0; i < header + payload; i++) chk ^= s[i];
+    s[header + payload] = chk;
+    return header + payload + 1;
+}
+
+static void dump (const char *what, ddcci_parse_kind_t kind, const uint8_t *s, int len)
+{
+    int i;
+
+    printf ("FAIL %s (%s):", what, kind == DDCCI_PARSE_REQUEST ? "request" : "reply");
+    for (i = 0; i < len; i++) printf (" %02x", s[i]);
+    printf ("\n");
+}
+
+/* one stream through the parser, returns the number of violated properties */
+static int test_one (test_mode_t mode)
+{
+    ddcci_parse_kind_t kind = (test_random () & 1) ? DDCCI_PARSE_REPLY : DDCCI_PARSE_REQUEST;
+    ddcci_parse_known_t known = (test_random () % 4 == 0) ? NULL :
+                                (kind == DDCCI_PARSE_REQUEST) ? known_request : known_reply;
+    ddcci_parser_t parser;
+    uint8_t stream[TEST_STREAM_MAX];
+    uint8_t frame[DDCCI_FRAME_MAX + TEST_GUARD];
+    uint8_t kept[DDCCI_FRAME_MAX];
+    ddcci_parse_status_t status, expected, verdict = DDCCI_PARSE_MORE;
+    int len = TEST_STREAM_MAX;
+    int frameLength = 0;
+    int at, verdictAt = -1;
+    int flipped = -1;
+    int failures = 0;
+    int i;
+
+    switch (mode)
+    {
+        case TEST_RANDOM:
+            for (i = 0; i < len; i++) stream[i] = test_random ();
+            break;
+
+        case TEST_HEADER:
+            make_frame (kind, known, stream);
+            for (i = (kind == DDCCI_PARSE_REQUEST) ? 3 : 2; i < len; i++) stream[i] = test_random ();
+            if (test_random () & 1) stream[(kind == DDCCI_PARSE_REQUEST) ? 2 : 1] = test_random ();
+            break;
+
+        case TEST_VALID:
+            frameLength = make_frame (kind, known, stream);
+            break;
+
+        case TEST_FLIPPED:
+            frameLength = make_frame (kind, known, stream);
+            do flipped = test_random () % frameLength;
+            while (flipped == ((kind == DDCCI_PARSE_REQUEST) ? 2 : 1));
+            stream[flipped] ^= 1 << (test_random () % 8);
+            break;
+
+        default:
+            break;
+    }
+    len = 1 + test_random () % TEST_STREAM_MAX;
+    if (len < frameLength) len = frameLength;
+
+    memset (frame, TEST_GUARD_BYTE, sizeof(frame));
+    ddcci_parse_init (&parser, kind, frame, known);
+    for (i = 0; i < len; i++)
+    {
+        status = ddcci_parse_byte (&parser, stream[i]);
+        if (verdictAt < 0 && status != DDCCI_PARSE_MORE)
+        {
+            verdict = status;
+            verdictAt = i;
+            memcpy (kept, frame, sizeof(kept));
+        }
+        else if (verdictAt >= 0 && status != verdict)
+        {
+            dump ("verdict changed", kind, stream, len);
+            failures++;
+            break;
+        }
+    }
+
+    expected = reference (kind, known, stream, len, &at);
+    if (verdict != expected || (verdictAt >= 0 && verdictAt != at))
+    {
+        dump ("verdict differs from the reference", kind, stream, len);
+        printf ("  parser %s at %d, reference %s at %d\n",
+                status_names[verdict], verdictAt, status_names[expected], at);
+        failures++;
+    }
+    if (mode == TEST_VALID && (verdict != DDCCI_PARSE_DONE || verdictAt != frameLength - 1))
+    {
+        dump ("valid frame refused", kind, stream, frameLength);
+        failures++;
+    }
+    if (mode == TEST_FLIPPED && verdict == DDCCI_PARSE_DONE)
+    {
+        dump ("corrupted frame accepted", kind, stream, frameLength);
+        failures++;
+    }
+    if (verdict == DDCCI_PARSE_DONE && memcmp (frame, stream, verdictAt + 1) != 0)
+    {
+        dump ("frame differs from the stream", kind, stream, verdictAt + 1);
+        failures++;
+    }
+    if (verdictAt >= 0 && memcmp (frame, kept, sizeof(kept)) != 0)
+    {
+        dump ("frame changed after the verdict", kind, stream, len);
+        failures++;
+    }
+    for (i = DDCCI_FRAME_MAX; i < (int)sizeof(frame); i++)
+    {
+        if (frame[i] != TEST_GUARD_BYTE)
+        {
+            dump ("written beyond the frame", kind, stream, len);
+            failures++;
+            break;
+        }
+    }
+
+    if (verbose > 1)
+    {
+        printf ("%-7s %-7s %s at %d\n", test_mode_names[mode],
+                kind == DDCCI_PARSE_REQUEST ? "request" : "reply", status_names[verdict], verdictAt);
+    }
+    return failures;
+}
+
+int main (int argc, char *argv[])
+{
+    unsigned long iterations = 1000000;
+    unsigned long i;
+    unsigned long failures = 0;
+    unsigned long seed = 1;
+    int opt;
+    test_mode_t mode;
+
+    while ((opt = getopt (argc, argv, "n:s:v")) != -1)
+    {
+        if (opt == 'n') iterations = strtoul (optarg, NULL, 0);
+        else if (opt == 's') seed = strtoul (optarg, NULL, 0);
+        else if (opt == 'v') verbose++;
+        else
+        {
+            fprintf (stderr, "Usage: %s [-n iterations] [-s seed] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    rng = seed ? seed : 1;
+    for (i = 0; i < iterations && failures < 10; i++)
+    {
+        mode = test_random () % TEST_MODES;
+        failures += test_one (mode);
+    }
+
+    printf ("%lu streams, seed %lu: %s\n", i, seed, failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Decode a text file of I2C line edges on a Linux host with the decoder
+ * the firmware uses. Each line holds "time sda scl", time in arbitrary
+ * monotonic units (e.g. cycles or ns from a logic analyzer export), sda
+ * and scl 0 or 1. Lines starting with '#' are ignored.
+ *
+ * Build: cc -O2 -I.. -o edgedecode edgedecode.c ../i2cdecode.c
+ * Usage: edgedecode [-t timeout] < edges.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i2cdecode.h"
+
+static void print_transaction (void *context, const i2c_transaction_t *t)
+{
+    uint16_t i;
+
+    (void)context;
+    printf ("%10u %8u %c%02x%s", t->start, t->end - t->start,
+            (t->flags & I2C_DECODE_READ) ? 'R' : 'W', t->address,
+            (t->nack[0] & 1) ? "-" : "+");
+    for (i = 0; i < t->length; i++)
+    {
+        printf (" %02x%s", t->payload[i], (t->nack[(i + 1) / 8] & (1 << ((i + 1) % 8))) ? "-" : "");
+    }
+    if (t->flags & I2C_DECODE_TRUNCATED) printf (" ...");
+    if (t->flags & I2C_DECODE_PARTIAL) printf (" (partial)");
+    printf ("%s\n", (t->flags & I2C_DECODE_STOP) ? " P" : "");
+}
+
+int main (int argc, char *argv[])
+{
+    i2c_decoder_t dec;
+    char line[128];
+    unsigned long time, last = 0;
+    unsigned sda, scl;
+    unsigned long timeout = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "t:")) != -1)
+    {
+        if (opt == 't')
+        {
+            timeout = strtoul (optarg, NULL, 0);
+        }
+        else
+        {
+            fprintf (stderr, "Usage: %s [-t timeout] < edges.txt\n", argv[0]);
+            return 1;
+        }
+    }
+
+    i2c_decode_init (&dec, print_transaction, NULL);
+    while (fgets (line, sizeof(line), stdin))
+    {
+        if (line[0] == '#' || sscanf (line, "%lu %u %u", &time, &sda, &scl) != 3) continue;
+        if (timeout) i2c_decode_timeout (&dec, time, timeout);
+        i2c_decode_edge (&dec, time, (sda ? I2C_DECODE_SDA : 0) | (scl ? I2C_DECODE_SCL : 0));
+        last = time;
+    }
+    i2c_decode_timeout (&dec, last + 1, 0);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Host-side cost of logging on the reply path, built once per LOG_LEVEL
+ * by 'make logsize'. A GetVCP reply goes through what the firmware does
+ * with it: ddcci_read_reply parses it byte by byte and logs it, and
+ * ddcci_write_master logs it once more on its way to the host. Both log
+ * through log_reply_received and log_reply_sent of log.h, as does the
+ * logcost shell command, and the writers are the real ones of log.c.
+ *
+ * log.c is included rather than linked so the benchmark can play the
+ * flush thread and empty the ring between two batches of replies; the
+ * formatting is not timed, it runs in a thread of its own on target.
+ * The best batch of many is reported, in TSC cycles on x86 and in
+ * nanoseconds elsewhere. Host cycles are not Cortex-M4 cycles, it is the
+ * difference between the two levels that matters.
+ *
+ * Build: cc -O2 -DLOG_LEVEL=3 -Istubs -I.. -o logbench logbench/logbench.c ../ddcciparse.c
+ * Usage: logbench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "log.c"
+#include "ddcciparse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static uint64_t bench_now (void) { return __rdtsc (); }
+#else
+#define BENCH_UNIT "ns"
+static uint64_t bench_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+/* a reply logs up to 4 records, a batch must not overrun the ring */
+#define BENCH_BATCH  (LOG_RING_SIZE / 4)
+#define BENCH_ROUNDS 20000
+
+SerialUSBDriver SDU1;
+
+rtcnt_t chSysGetRealtimeCounterX (void) { return (rtcnt_t)bench_now (); }
+void chRegSetThreadName (const char *name) { (void)name; }
+void chThdSleepMilliseconds (uint32_t ms) { (void)ms; }
+void *chThdCreateStatic (void *wa, size_t size, int prio, void (*fn) (void *), void *arg)
+{
+  (void)wa; (void)size; (void)prio; (void)fn; (void)arg;
+  return NULL;
+}
+int chprintf (BaseSequentialStream *chp, const char *fmt, ...) { (void)chp; (void)fmt; return 0; }
+
+/* GetVCP reply for brightness 50 of 100, as read at 6F */
+static const uint8_t reply[] = {0x6E, 0x88, 0x02, 0x00, 0x10, 0x00, 0x00, 0x64, 0x00, 0x32, 0xF2};
+
+static volatile uint8_t sink;
+
+/* what the flush thread does with a record, less the formatting */
+static void bench_drain (void)
+{
+  log_record_t *record;
+
+  for (;;)
+  {
+    record = &ring[tail & (LOG_RING_SIZE - 1)];
+    if (__atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE) != tail + 1) break;
+    __atomic_store_n (&record->sequence, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    tail++;
+  }
+}
+
+/* the reply path of ddcci_read_reply and ddcci_write_master */
+static void bench_reply (void)
+{
+  uint8_t result[DDCCI_FRAME_MAX];
+  ddcci_parser_t parser;
+  ddcci_parse_status_t status = DDCCI_PARSE_MORE;
+  uint8_t i;
+
+  ddcci_parse_init (&parser, DDCCI_PARSE_REPLY, result, NULL);
+  for (i = 0; i < sizeof(reply) && status == DDCCI_PARSE_MORE; i++)
+  {
+    status = ddcci_parse_byte (&parser, reply[i]);
+  }
+  sink = status;
+
+  log_reply_received (result, parser.count);
+  log_reply_sent (result, parser.count);
+}
+
+int main (int argc, char **argv)
+{
+  uint32_t rounds = (argc > 1) ? strtoul (argv[1], NULL, 0) : BENCH_ROUNDS;
+  uint64_t start, elapsed, best = UINT64_MAX;
+  uint32_t round, i;
+
+  log_start ();
+  for (round = 0; round < rounds; round++)
+  {
+    start = bench_now ();
+    for (i = 0; i < BENCH_BATCH; i++)
+    {
+      bench_reply ();
+    }
+    elapsed = bench_now () - start;
+    if (elapsed < best) best = elapsed;
+    bench_drain ();
+  }
+
+  if (sink != DDCCI_PARSE_DONE || log_dropped ())
+  {
+    fprintf (stderr, "logbench: reply not parsed or log records dropped\n");
+    return 1;
+  }
+
+  printf ("LOG_LEVEL=%d: %llu " BENCH_UNIT " per reply\n", LOG_LEVEL, (unsigned long long)(best / BENCH_BATCH));
+  return 0;
+}
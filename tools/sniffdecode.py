@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+# REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+# FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+# INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+# LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+# OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+# PERFORMANCE OF THIS SOFTWARE.
+#
+
+"""Print the transactions streamed by the 'sniff' shell command.
+
+Reads a capture file, or the serial device itself to follow the bus live.
+With --correlate, a capture of 'sniff both' taken on both sides of a proxy
+is reduced to one line per DDC/CI request: the time the host waited for
+the reply, the time the monitor took and the difference the proxy added.
+Requests the host gave up on are flagged as timeouts, as caused by the
+proxy if the monitor had answered before the host's last read attempt.
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct("<BBBBHII")
+SYNC = 0xC3
+
+FLAGS = ((0x02, "P"), (0x04, "Sr"), (0x08, "truncated"), (0x10, "partial"))
+READ = 0x01
+MONITOR = 0x20
+
+DDCCI_ADDRESS = 0x37
+WRITE_ONLY = (0x03, 0x0C, 0xE7)  # set VCP, save settings, table write
+
+
+def transactions(stream):
+    """Yield (header fields, payload, nack bits) tuples, resyncing on garbage."""
+    data = b""
+    while True:
+        chunk = stream.read(1 if stream.isatty() else 4096)
+        if not chunk:
+            return
+        data += chunk
+        while True:
+            start = data.find(bytes([SYNC]))
+            if start < 0:
+                data = b""
+                break
+            data = data[start:]
+            if len(data) < RECORD.size:
+                break
+            fields = RECORD.unpack_from(data)
+            length = fields[3]
+            end = RECORD.size + length + (length + 8) // 8
+            if len(data) < end:
+                break
+            payload = data[RECORD.size:RECORD.size + length]
+            pattern = data[RECORD.size + length:end]
+            nack = [(pattern[i // 8] >> (i % 8)) & 1 for i in range(length + 1)]
+            data = data[end:]
+            yield fields, payload, nack
+
+
+class Request:
+    def __init__(self, payload, start):
+        self.payload = payload
+        self.host = start          # host started the request
+        self.forwarded = None      # proxy started the request on the monitor bus
+        self.answered = None       # monitor reply completely read by the proxy
+        self.last_null = None      # latest null message the host read
+        self.nulls = 0
+
+    def opcode(self):
+        return self.payload[2] if len(self.payload) > 2 else None
+
+    def expects_reply(self):
+        return self.opcode() not in WRITE_ONLY
+
+
+def correlate(stream):
+    print("%10s %6s %10s %10s %10s %5s" % ("start/us", "opcode", "host/us", "monitor/us", "added/us", "nulls"))
+    request = None
+    timeouts = proxy_timeouts = 0
+
+    def report(request, host=None, note=""):
+        monitor = request.answered - request.forwarded if request.answered and request.forwarded else None
+        added = host - monitor if host is not None and monitor is not None else None
+        field = lambda v: "%10d" % v if v is not None else "%10s" % "-"
+        print("%10d     %02x %s %s %s %5d %s" % (request.host, request.opcode() or 0, field(host),
+              field(monitor), field(added), request.nulls, note))
+
+    for (_, flags, address, _, _, start, duration), payload, _ in transactions(stream):
+        if address != DDCCI_ADDRESS or len(payload) < 2:
+            continue
+        monitor, read = flags & MONITOR, flags & READ
+
+        if not monitor and not read:
+            if request and payload == request.payload:
+                continue  # host retry
+            if request and request.expects_reply():
+                # the host moved on without a reply
+                timeouts += 1
+                caused = request.answered is not None and request.last_null is not None and \
+                    request.answered < request.last_null
+                proxy_timeouts += caused
+                report(request, note="timeout (proxy)" if caused else "timeout")
+            request = Request(payload, start)
+
+        elif request is None:
+            continue
+
+        elif monitor and not read:
+            if request.forwarded is None and payload == request.payload:
+                request.forwarded = start
+                if not request.expects_reply():
+                    report(request, note="forwarded after %d us" % (start - request.host))
+                    request = None
+
+        elif monitor:
+            if request.forwarded is not None and payload[1] != 0x80:
+                request.answered = start + duration
+
+        elif payload[1] == 0x80:
+            request.nulls += 1
+            request.last_null = start
+
+        else:
+            report(request, host=start - request.host, note="" if request.forwarded else "cached")
+            request = None
+
+    print("host timeouts %d, caused by the proxy %d" % (timeouts, proxy_timeouts))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", help="capture file or serial device")
+    parser.add_argument("--correlate", action="store_true", help="relate host and monitor bus of 'sniff both'")
+    args = parser.parse_args()
+
+    with open(args.file, "rb", buffering=0) as stream:
+        if args.correlate:
+            correlate(stream)
+            return
+        for (_, flags, address, _, lost, start, duration), payload, nack in transactions(stream):
+            if lost:
+                print("%d transactions lost" % lost)
+            text = " ".join("%02x%s" % (b, "-" if n else "") for b, n in zip(payload, nack[1:]))
+            notes = " ".join(name for bit, name in FLAGS if flags & bit)
+            print("%10d %6d us %-7s %02x %s%s %s %s" % (start, duration,
+                  "monitor" if flags & MONITOR else "host", address << 1 | (flags & 1),
+                  "R" if flags & 1 else "W", "-" if nack[0] else " ", text, notes))
+            sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
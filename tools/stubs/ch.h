@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Stand-in for the ChibiOS kernel header, just what the code built by the
+ * host tools uses. Each tool defines the functions it calls.
+ */
+
+#ifndef CH_H
+#define CH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t rtcnt_t;
+typedef uint32_t systime_t;
+
+rtcnt_t chSysGetRealtimeCounterX (void);
+
+#define chSysLock()
+#define chSysUnlock()
+
+#define LOWPRIO 1
+#define THD_WORKING_AREA(name, size) uint8_t name[size]
+#define THD_FUNCTION(name, arg) void name (void *arg)
+
+void chRegSetThreadName (const char *name);
+void chThdSleepMilliseconds (uint32_t ms);
+void *chThdCreateStatic (void *wa, size_t size, int prio, void (*fn) (void *), void *arg);
+
+#endif // CH_H
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Stand-in for the ChibiOS HAL header. In bbi2csim port accesses go to
+ * its bus model, which charges simulated CPU cycles for every access.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#include "ch.h"
+
+#define STM32_HCLK 72000000
+
+typedef struct
+{
+    int port;
+} stm32_gpio_t;
+
+typedef struct BaseSequentialStream BaseSequentialStream;
+typedef struct { int unused; } USBConfig;
+typedef struct { int unused; } SerialUSBConfig;
+typedef struct { int unused; } SerialUSBDriver;
+
+size_t chSequentialStreamWrite (BaseSequentialStream *chp, const uint8_t *bp, size_t n);
+
+#define PAL_MODE_INPUT             0
+#define PAL_MODE_OUTPUT_OPENDRAIN  1
+#define PAL_STM32_OSPEED_HIGHEST   0
+
+uint32_t palReadPad (stm32_gpio_t *port, int pin);
+void palSetPad (stm32_gpio_t *port, int pin);
+void palClearPad (stm32_gpio_t *port, int pin);
+void palSetPadMode (stm32_gpio_t *port, int pin, int mode);
+
+#endif // HAL_H
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+# REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+# FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+# INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+# LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+# OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+# PERFORMANCE OF THIS SOFTWARE.
+#
+
+"""Decode a binary bus trace written by the 'trace raw' shell command.
+
+The input may contain shell output around the capture, it is located by
+its "DDCT" magic. Byte records can be expanded to the SDA/SCL transitions
+they stand for with --bits; their timing is then spread evenly over the
+duration of the byte. tracetest/tracetest.py checks the encoding of
+trace.c against this decoder.
+"""
+
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("<4sBBHIIII")
+
+TRACE_SDA = 0x01
+TRACE_SCL = 0x02
+TRACE_NACK = 0x01
+TRACE_FIRST = 0x20
+TRACE_MONITOR = 0x40
+TRACE_BYTE = 0x80
+
+
+def varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def records(capture):
+    """Yield (offset, cycles, header, data, duration_cycles) per record."""
+    magic, version, shift, _, clock, base, trigger, length = HEADER.unpack_from(capture)
+    if magic != b"DDCT" or version != 1:
+        raise ValueError("not a version 1 trace")
+    data = capture[HEADER.size:HEADER.size + length]
+    if len(data) != length:
+        raise ValueError("truncated trace, %d of %d bytes" % (len(data), length))
+
+    pos = 0
+    time = base
+    while pos < length:
+        offset = pos
+        header = data[pos]
+        zigzag, pos = varint(data, pos + 1)
+        time += ((zigzag >> 1) ^ -(zigzag & 1)) << shift
+        byte = duration = None
+        if header & TRACE_BYTE:
+            byte = data[pos]
+            duration, pos = varint(data, pos + 1)
+            duration <<= shift
+        yield offset, time, header, byte, duration
+
+
+def transitions(time, header, byte, duration):
+    """SDA/SCL levels of a clean byte record, ending with the final SCL fall."""
+    bits = [(byte >> (7 - i)) & 1 for i in range(8)] + [header & TRACE_NACK]
+    step = duration / (len(bits) * 3)
+    start = time - duration
+    sda = None
+    result = []
+    for i, bit in enumerate(bits):
+        t = start + 3 * i * step
+        if bit != sda:
+            result.append((t, bit, 0))
+            sda = bit
+        result.append((t + step, bit, 1))
+        result.append((t + 2 * step if i < len(bits) - 1 else time, bit, 0))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", help="captured output of 'trace raw'")
+    parser.add_argument("--bits", action="store_true", help="expand byte records into transitions")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        raw = f.read()
+    start = raw.find(b"DDCT")
+    if start < 0:
+        sys.exit("no trace found in %s" % args.file)
+    capture = raw[start:]
+    clock = HEADER.unpack_from(capture)[4]
+    trigger = HEADER.unpack_from(capture)[6]
+
+    listing = list(records(capture))
+    reference = listing[0][1] if listing else 0
+    for offset, time, header, byte, duration in listing:
+        if offset == trigger:
+            reference = time
+
+    def us(t):
+        # rounded towards zero like the listing of the 'trace dump' command
+        delta = abs(t - reference) * 1000000 // clock
+        return delta if t >= reference else -delta
+
+    for offset, time, header, byte, duration in listing:
+        mark = "*" if offset == trigger else " "
+        bus = "monitor" if header & TRACE_MONITOR else "host"
+        if not header & TRACE_BYTE:
+            print("%s %9d %-7s SDA=%d SCL=%d" % (mark, us(time), bus,
+                  1 if header & TRACE_SDA else 0, 1 if header & TRACE_SCL else 0))
+        elif args.bits:
+            for t, sda, scl in transitions(time, header, byte, duration):
+                print("%s %9d %-7s SDA=%d SCL=%d" % (mark, us(t), bus, sda, scl))
+                mark = " "
+        else:
+            print("%s %9d %-7s %s%02x %s in %d us" % (mark, us(time), bus,
+                  "@" if header & TRACE_FIRST else "", byte,
+                  "NACK" if header & TRACE_NACK else "ACK", duration * 1000000 // clock))
+
+
+if __name__ == "__main__":
+    main()
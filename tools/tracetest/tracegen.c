@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+/*
+ * Synthetic bus traffic for the trace round trip test (tracetest.py).
+ * DDC/CI-like transfers on both buses at 100 kHz, with repeated STARTs,
+ * NACKs, clock stretching and now and then SDA and SCL changing at once,
+ * are fed to trace.c as the bus code would. The encoded capture is
+ * written like 'trace raw' does, the transfers as a list of events.
+ *
+ * Build: cc -O2 -Istubs -I.. -o tracegen tracetest/tracegen.c ../trace.c
+ * Usage: tracegen <capture> <events> [seed] [transfers per bus]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "trace.h"
+
+#define GEN_QUARTER  180    /* cycles, a quarter of a 100 kHz bit at 72 MHz */
+#define GEN_EDGES    32768
+#define GEN_EVENTS   8192
+#define GEN_LINE_MAX 64
+
+struct BaseSequentialStream
+{
+  FILE *file;
+};
+
+typedef struct
+{
+  uint32_t time;
+  uint8_t  bus;
+  uint8_t  lines;
+} gen_edge_t;
+
+typedef struct
+{
+  uint8_t  bus;
+  uint8_t  lines;
+  uint32_t time;
+  uint32_t byteStart;  /* first transition of the current byte */
+  uint8_t  started;
+} gen_bus_t;
+
+static gen_edge_t edges[GEN_EDGES];
+static unsigned edgeCount;
+static char events[GEN_EVENTS][GEN_LINE_MAX];
+static unsigned eventCount;
+static uint32_t now;
+static uint32_t rng;
+
+rtcnt_t chSysGetRealtimeCounterX (void)
+{
+  return now;
+}
+
+size_t chSequentialStreamWrite (BaseSequentialStream *chp, const uint8_t *bp, size_t n)
+{
+  return fwrite (bp, 1, n, chp->file);
+}
+
+int chprintf (BaseSequentialStream *chp, const char *fmt, ...)
+{
+  (void)chp;
+  (void)fmt;
+  return 0;
+}
+
+static uint32_t gen_random (void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void gen_line (gen_bus_t *g, uint8_t lines)
+{
+  if (lines == g->lines) return;
+  if (edgeCount == GEN_EDGES)
+  {
+    fprintf (stderr, "too many edges\n");
+    exit (1);
+  }
+  edges[edgeCount].time = g->time;
+  edges[edgeCount].bus = g->bus;
+  edges[edgeCount].lines = lines;
+  edgeCount++;
+  if (!g->started)
+  {
+    g->byteStart = g->time;
+    g->started = 1;
+  }
+  g->lines = lines;
+}
+
+static void gen_event (const char *fmt, unsigned bus, uint32_t time, unsigned a, unsigned b, unsigned c, unsigned d)
+{
+  if (eventCount == GEN_EVENTS)
+  {
+    fprintf (stderr, "too many events\n");
+    exit (1);
+  }
+  snprintf (events[eventCount++], GEN_LINE_MAX, fmt, bus, time, a, b, c, d);
+}
+
+/* START from an idle bus or, with SCL low after a byte, a repeated START */
+static void gen_start (gen_bus_t *g)
+{
+  if (!(g->lines & TRACE_SCL))
+  {
+    g->time += GEN_QUARTER;
+    gen_line (g, TRACE_SDA);
+    g->time += GEN_QUARTER;
+    gen_line (g, TRACE_SDA | TRACE_SCL);
+  }
+  g->time += 2 * GEN_QUARTER;
+  gen_line (g, TRACE_SCL);
+  gen_event ("S %u %u\n", g->bus, g->time, 0, 0, 0, 0);
+  g->started = 0;
+  g->time += GEN_QUARTER;
+  gen_line (g, 0);
+}
+
+static void gen_stop (gen_bus_t *g)
+{
+  g->time += GEN_QUARTER;
+  gen_line (g, 0);
+  g->time += GEN_QUARTER;
+  gen_line (g, TRACE_SCL);
+  g->time += GEN_QUARTER;
+  gen_line (g, TRACE_SDA | TRACE_SCL);
+  gen_event ("P %u %u\n", g->bus, g->time, 0, 0, 0, 0);
+}
+
+/* eight data bits and the ACK bit, 'messy' raises SCL together with an SDA change */
+static void gen_byte (gen_bus_t *g, uint8_t data, uint8_t nack, uint8_t first, uint8_t messy)
+{
+  uint8_t i, sda;
+
+  for (i = 0; i < 9; i++)
+  {
+    sda = (i < 8 ? (data >> (7 - i)) & 1 : nack) ? TRACE_SDA : 0;
+    g->time += GEN_QUARTER;
+    if (messy && sda != (g->lines & TRACE_SDA))
+    {
+      gen_line (g, sda | TRACE_SCL);
+      messy = 0;
+    }
+    else
+    {
+      gen_line (g, sda);
+      if (gen_random () % 64 == 0) g->time += gen_random () % 20000;  /* clock stretched */
+      g->time += GEN_QUARTER;
+      gen_line (g, sda | TRACE_SCL);
+    }
+    g->time += 2 * GEN_QUARTER;
+    gen_line (g, sda);
+  }
+  gen_event ("B %u %u %u %u %u %u\n", g->bus, g->time, data, nack, first, g->time - g->byteStart);
+  g->started = 0;
+}
+
+static void gen_bytes (gen_bus_t *g, uint8_t address, uint8_t count, uint8_t nackLast)
+{
+  uint8_t i;
+
+  gen_byte (g, address, 0, 1, 0);
+  for (i = 0; i < count; i++)
+  {
+    gen_byte (g, gen_random (), nackLast && i == count - 1, 0, gen_random () % 32 == 0);
+  }
+}
+
+/* one transfer of a DDC/CI host or monitor, then some idle time */
+static void gen_transfer (gen_bus_t *g)
+{
+  switch (gen_random () % 4)
+  {
+    case 0: /* request */
+      gen_start (g);
+      gen_bytes (g, 0x6E, 4 + gen_random () % 8, 0);
+      gen_stop (g);
+      break;
+    case 1: /* reply read */
+      gen_start (g);
+      gen_bytes (g, 0x6F, 4 + gen_random () % 10, 1);
+      gen_stop (g);
+      break;
+    case 2: /* EDID offset write and read after a repeated START */
+      gen_start (g);
+      gen_bytes (g, 0xA0, 1, 0);
+      gen_start (g);
+      gen_bytes (g, 0xA1, 8 + gen_random () % 16, 1);
+      gen_stop (g);
+      break;
+    default: /* nobody answers the address */
+      gen_start (g);
+      gen_byte (g, 0x6E, 1, 1, 0);
+      gen_stop (g);
+      break;
+  }
+  g->time += 720 * (5 + gen_random () % 50);
+}
+
+static int gen_compare (const void *a, const void *b)
+{
+  const gen_edge_t *x = a, *y = b;
+
+  if (x->time != y->time) return x->time < y->time ? -1 : 1;
+  return x->bus - y->bus;  /* the edges of one bus all have different times */
+}
+
+int main (int argc, char *argv[])
+{
+  BaseSequentialStream capture;
+  FILE *out;
+  gen_bus_t bus[2];
+  unsigned transfers, i, b;
+
+  if (argc < 3)
+  {
+    fprintf (stderr, "Usage: %s <capture> <events> [seed] [transfers per bus]\n", argv[0]);
+    return 1;
+  }
+  rng = argc > 3 ? strtoul (argv[3], NULL, 0) : 1;
+  if (!rng) rng = 1;
+  transfers = argc > 4 ? strtoul (argv[4], NULL, 0) : 30;
+
+  for (b = 0; b < 2; b++)
+  {
+    bus[b].bus = b;
+    bus[b].lines = TRACE_SDA | TRACE_SCL;
+    bus[b].time = 100000 + gen_random () % 7200;
+    bus[b].started = 0;
+    for (i = 0; i < transfers; i++) gen_transfer (&bus[b]);
+  }
+
+  /* both buses run at the same time */
+  qsort (edges, edgeCount, sizeof(edges[0]), gen_compare);
+
+  now = 1000;
+  trace_arm (TRACE_TRIGGER_ADDRESS, 0x00, 0);  /* never fires, the whole transfer stays in the ring */
+  for (i = 0; i < edgeCount; i++)
+  {
+    now = edges[i].time;
+    trace_sample (edges[i].bus, edges[i].lines & TRACE_SDA, edges[i].lines & TRACE_SCL);
+  }
+  trace_stop ();
+
+  capture.file = fopen (argv[1], "wb");
+  out = fopen (argv[2], "w");
+  if (!capture.file || !out)
+  {
+    perror ("fopen");
+    return 1;
+  }
+  trace_dump_binary (&capture);
+  fclose (capture.file);
+
+  fprintf (out, "E %u %u %u\n", edgeCount, edges[0].time, edges[edgeCount - 1].time);
+  for (i = 0; i < eventCount; i++) fputs (events[i], out);
+  fclose (out);
+  return 0;
+}
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+# REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+# FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+# INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+# LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+# OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+# PERFORMANCE OF THIS SOFTWARE.
+#
+
+"""Round trip test of the bus trace encoding.
+
+Builds trace.c for the host together with tracetest/tracegen.c, which
+feeds it synthetic traffic on both buses, and decodes the capture with
+tracedecode.py. The START, STOP and byte events decoded must match the
+generated ones, times and byte durations to the resolution of the
+encoding, and the capture must take at most a tenth of the bytes per
+bus-second of the former raw format (5 bytes per transition).
+
+Usage: tracetest/tracetest.py [--seeds N] [--transfers N] [--cc CC]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.dont_write_bytecode = True
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+
+import tracedecode  # noqa: E402
+
+RAW_RECORD = 5      # bytes per transition of the raw format
+MIN_DENSITY = 10    # required gain in bus time per byte
+
+
+class Bus:
+    """Bit-level I2C decoder for the transition records of one bus."""
+
+    def __init__(self):
+        self.lines = tracedecode.TRACE_SDA | tracedecode.TRACE_SCL
+        self.bits = None  # idle
+        self.shift = 0
+        self.first = False
+
+    def lines_record(self, time, lines, events):
+        was, self.lines = self.lines, lines
+        sda = lines & tracedecode.TRACE_SDA
+        scl = tracedecode.TRACE_SCL
+        if was & scl and lines & scl and (was ^ lines) & tracedecode.TRACE_SDA:
+            if sda:
+                events.append(("P", time))
+                self.bits = None
+            else:
+                events.append(("S", time))
+                self.bits, self.shift, self.first = 0, 0, True
+        elif self.bits is None:
+            pass
+        elif not was & scl and lines & scl:
+            if self.bits < 8:
+                self.shift = (self.shift << 1) | (1 if sda else 0)
+                self.bits += 1
+            elif self.bits == 8:
+                self.nack = 1 if sda else 0
+                self.bits = 9
+        elif was & scl and not lines & scl and self.bits == 9:
+            events.append(("B", time, self.shift, self.nack, int(self.first), None))
+            self.bits, self.shift, self.first = 0, 0, False
+
+    def byte_record(self, time, header, byte, duration, events):
+        nack = header & tracedecode.TRACE_NACK
+        events.append(("B", time, byte, nack, 1 if header & tracedecode.TRACE_FIRST else 0, duration))
+        self.lines = tracedecode.TRACE_SDA if nack else 0
+        self.bits, self.shift, self.first = 0, 0, False
+
+
+def decode(capture):
+    buses = [Bus(), Bus()]
+    events = [[], []]
+    for _, time, header, byte, duration in tracedecode.records(capture):
+        bus = 1 if header & tracedecode.TRACE_MONITOR else 0
+        if header & tracedecode.TRACE_BYTE:
+            buses[bus].byte_record(time, header, byte, duration, events[bus])
+        else:
+            buses[bus].lines_record(time, header & (tracedecode.TRACE_SDA | tracedecode.TRACE_SCL), events[bus])
+    return events
+
+
+def expected(path):
+    events = [[], []]
+    with open(path) as f:
+        _, edges, first, last = f.readline().split()
+        for line in f:
+            fields = line.split()
+            kind, bus, values = fields[0], int(fields[1]), [int(v) for v in fields[2:]]
+            events[bus].append((kind, *values))
+    return events, int(edges), int(last) - int(first)
+
+
+def compare(got, want, resolution):
+    """First difference between decoded and generated events of one bus, or None."""
+    for i, (g, w) in enumerate(zip(got, want)):
+        if g[0] != w[0] or abs(g[1] - w[1]) >= resolution:
+            return i, g, w
+        if g[0] == "B":
+            if g[2:5] != w[2:5] or (g[5] is not None and abs(g[5] - w[5]) >= resolution):
+                return i, g, w
+    if len(got) != len(want):
+        return min(len(got), len(want)), got[len(want):], want[len(got):]
+    return None
+
+
+def run(tracegen, workdir, seed, transfers):
+    capture_path = os.path.join(workdir, "trace.bin")
+    events_path = os.path.join(workdir, "events.txt")
+    subprocess.run([tracegen, capture_path, events_path, str(seed), str(transfers)], check=True)
+    with open(capture_path, "rb") as f:
+        capture = f.read()
+
+    header = tracedecode.HEADER.unpack_from(capture)
+    shift, clock, length = header[2], header[4], header[7]
+    got = decode(capture)
+    want, edges, span = expected(events_path)
+
+    failed = False
+    for bus in (0, 1):
+        difference = compare(got[bus], want[bus], 1 << shift)
+        if difference:
+            print("seed %d, bus %d, event %d: decoded %s, generated %s" % ((seed, bus) + difference))
+            failed = True
+
+    seconds = span / clock
+    encoded = length / seconds
+    raw = edges * RAW_RECORD / seconds
+    if raw < MIN_DENSITY * encoded:
+        print("seed %d: %d bytes per bus-second, raw %d, only %.1fx" % (seed, encoded, raw, raw / encoded))
+        failed = True
+    return failed, raw / encoded, encoded
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--seeds", type=int, default=20, help="number of generated captures")
+    parser.add_argument("--transfers", type=int, default=30, help="transfers per bus and capture")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="host C compiler")
+    args = parser.parse_args()
+
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        tracegen = os.path.join(workdir, "tracegen")
+        subprocess.run([args.cc, "-O2", "-Wall", "-Wextra", "-I" + os.path.join(HERE, "..", "stubs"), "-I" + os.path.join(HERE, "..", ".."),
+                        "-o", tracegen, os.path.join(HERE, "tracegen.c"),
+                        os.path.join(HERE, "..", "..", "trace.c")], check=True)
+        worst = None
+        for seed in range(1, args.seeds + 1):
+            result, gain, encoded = run(tracegen, workdir, seed, args.transfers)
+            failed |= result
+            if worst is None or gain < worst[0]:
+                worst = (gain, encoded)
+
+    print("%d captures %s, worst density %.1fx of raw, %d bytes per bus-second"
+          % (args.seeds, "FAILED" if failed else "ok", worst[0], worst[1]))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Bit-level trace of both buses. Every SDA/SCL change the bus code sees
+ * is fed to a small I2C decoder per bus, which watches for the trigger
+ * and encodes the activity into a byte ring (see trace.h): transitions
+ * of a byte are held back until its ACK bit is clocked and replaced by
+ * a single byte record, anything unusual is kept transition by
+ * transition. After the trigger the ring is filled up to leave
+ * 'pretrigger' bytes before it and then frozen, so it can be dumped
+ * while the proxy keeps running.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "trace.h"
+
+#include "chprintf.h"
+
+#define TRACE_IDLE_BITS  0xFF  /* no transfer since the last STOP */
+#define TRACE_PENDING    40    /* transitions held back per byte */
+#define TRACE_RECORD_MAX 12    /* header, data and two varints */
+
+typedef struct
+{
+  uint8_t  lines;  /* last seen TRACE_SDA/TRACE_SCL */
+  uint8_t  bits;   /* bits of the current byte seen so far */
+  uint8_t  shift;
+  uint8_t  first;  /* current byte is the one after START */
+  uint8_t  nack;
+  uint8_t  fire;   /* trigger seen, marks the next record of this bus */
+  uint8_t  clean;  /* all transitions of the current byte are held back */
+  uint8_t  count;  /* transitions of the current byte */
+  uint8_t  pendingLines[TRACE_PENDING];
+  uint32_t pendingTimes[TRACE_PENDING];
+} trace_decoder_t;
+
+/* the ring lives in CCM, it is large and never accessed by DMA */
+static uint8_t ring[TRACE_BYTES] __attribute__((section(".ram4")));
+
+static uint16_t head;        /* next byte written */
+static uint16_t tail;        /* first byte of the oldest record */
+static uint16_t used;
+static uint32_t base;        /* time of the record before the oldest one */
+static uint32_t last;        /* time of the newest record */
+static uint16_t triggerAt = TRACE_BYTES; /* offset of the trigger record */
+static uint16_t remaining;   /* bytes still recorded after the trigger */
+static uint16_t pre;
+static trace_trigger_t trigger;
+static uint8_t  triggerAddress;
+static trace_state_t state = TRACE_IDLE;
+static trace_decoder_t decoders[2];
+
+volatile uint8_t trace_recording;
+
+static uint8_t trace_put_varint (uint8_t *out, uint32_t value)
+{
+  uint8_t n = 0;
+
+  while (value >= 0x80)
+  {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+static uint32_t trace_get_varint (uint16_t *offset)
+{
+  uint32_t value = 0;
+  uint8_t shift = 0, byte;
+
+  do
+  {
+    byte = ring[*offset];
+    *offset = (*offset + 1) % TRACE_BYTES;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  return value;
+}
+
+/* parse the record at 'offset', advancing it to the next one */
+static int32_t trace_get_record (uint16_t *offset, uint8_t *header, uint8_t *data, uint32_t *duration)
+{
+  uint32_t zigzag;
+
+  *header = ring[*offset];
+  *offset = (*offset + 1) % TRACE_BYTES;
+  zigzag = trace_get_varint (offset);
+  if (*header & TRACE_BYTE)
+  {
+    *data = ring[*offset];
+    *offset = (*offset + 1) % TRACE_BYTES;
+    *duration = trace_get_varint (offset);
+  }
+  return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
+
+/* append a record for an event at time 't', dropping the oldest ones if needed */
+static void trace_emit (trace_decoder_t *dec, uint8_t header, uint32_t t, uint8_t data, uint32_t duration)
+{
+  uint8_t record[TRACE_RECORD_MAX];
+  uint8_t n = 1, i, dummy;
+  uint16_t dropped;
+  uint32_t skipped;
+  int32_t delta;
+
+  if (state != TRACE_ARMED && state != TRACE_TRIGGERED) return;
+
+  /* the newest time is kept at the resolution it was encoded with, so no error adds up */
+  delta = (int32_t)(t - last) >> TRACE_TIME_SHIFT;
+  last += (uint32_t)delta << TRACE_TIME_SHIFT;
+
+  record[0] = header;
+  n += trace_put_varint (&record[n], ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+  if (header & TRACE_BYTE)
+  {
+    record[n++] = data;
+    n += trace_put_varint (&record[n], duration >> TRACE_TIME_SHIFT);
+  }
+
+  while (used + n > TRACE_BYTES)
+  {
+    dropped = tail;
+    base += (uint32_t)trace_get_record (&tail, &dummy, &dummy, &skipped) << TRACE_TIME_SHIFT;
+    used -= (tail + TRACE_BYTES - dropped) % TRACE_BYTES;
+  }
+
+  if (dec->fire && state == TRACE_ARMED)
+  {
+    triggerAt = head;
+    remaining = TRACE_BYTES - pre;
+    state = TRACE_TRIGGERED;
+  }
+  dec->fire = 0;
+
+  for (i = 0; i < n; i++)
+  {
+    ring[head] = record[i];
+    head = (head + 1) % TRACE_BYTES;
+  }
+  used += n;
+
+  if (state == TRACE_TRIGGERED)
+  {
+    if (remaining <= n + TRACE_RECORD_MAX)
+    { /* the next record could push the trigger out of the ring */
+      state = TRACE_DONE;
+      trace_recording = 0;
+    }
+    else remaining -= n;
+  }
+}
+
+static uint8_t trace_bus_bit (trace_decoder_t *dec)
+{
+  return dec == &decoders[TRACE_BUS_MONITOR] ? TRACE_MONITOR : 0;
+}
+
+/* the held back transitions are not a clean byte, record them one by one */
+static void trace_flush (trace_decoder_t *dec)
+{
+  uint8_t i;
+
+  for (i = 0; i < dec->count; i++)
+  {
+    trace_emit (dec, trace_bus_bit (dec) | dec->pendingLines[i], dec->pendingTimes[i], 0, 0);
+  }
+  dec->count = 0;
+}
+
+/* feed one transition at time 't' to the decoder of its bus */
+static void trace_decode (trace_decoder_t *dec, uint8_t now, uint32_t t)
+{
+  uint8_t was = dec->lines;
+  int sda = now & TRACE_SDA;
+
+  dec->lines = now;
+
+  if ((was & TRACE_SCL) && (now & TRACE_SCL))
+  { /* SDA changed while SCL is high, START or STOP */
+    trace_flush (dec);
+    if (sda)
+    {
+      dec->bits = TRACE_IDLE_BITS;
+    }
+    else
+    {
+      dec->bits = 0;
+      dec->shift = 0;
+      dec->first = 1;
+      dec->clean = 1;
+      if (trigger == TRACE_TRIGGER_START) dec->fire = 1;
+    }
+    trace_emit (dec, trace_bus_bit (dec) | now, t, 0, 0);
+    return;
+  }
+
+  if (dec->bits == TRACE_IDLE_BITS)
+  {
+    trace_emit (dec, trace_bus_bit (dec) | now, t, 0, 0);
+    return;
+  }
+
+  if (((was ^ now) & (TRACE_SDA | TRACE_SCL)) == (TRACE_SDA | TRACE_SCL) || dec->count == TRACE_PENDING)
+  { /* both lines changed at once or the byte takes unusually long */
+    trace_flush (dec);
+    dec->clean = 0;
+  }
+  if (dec->clean)
+  {
+    dec->pendingLines[dec->count] = now;
+    dec->pendingTimes[dec->count] = t;
+    dec->count++;
+  }
+  else trace_emit (dec, trace_bus_bit (dec) | now, t, 0, 0);
+
+  if (!(was & TRACE_SCL) && (now & TRACE_SCL))
+  { /* rising SCL, the data bit is valid */
+    if (dec->bits < 8)
+    {
+      dec->shift = (dec->shift << 1) | (sda ? 1 : 0);
+      if (++dec->bits == 8 && trigger == TRACE_TRIGGER_ADDRESS && dec->first && dec->shift == triggerAddress)
+      {
+        dec->fire = 1;
+      }
+    }
+    else if (dec->bits == 8)
+    {
+      dec->nack = sda ? 1 : 0;
+      dec->bits = 9;
+      if (dec->nack && trigger == TRACE_TRIGGER_NACK) dec->fire = 1;
+    }
+  }
+  else if ((was & TRACE_SCL) && !(now & TRACE_SCL) && dec->bits == 9)
+  { /* ACK bit is over, the byte is complete */
+    if (dec->clean)
+    {
+      trace_emit (dec, trace_bus_bit (dec) | TRACE_BYTE | (dec->first ? TRACE_FIRST : 0) | dec->nack,
+                  t, dec->shift, t - dec->pendingTimes[0]);
+    }
+    dec->count = 0;
+    dec->bits = 0;
+    dec->shift = 0;
+    dec->first = 0;
+    dec->clean = 1;
+  }
+}
+
+void trace_sample (trace_bus_t bus, int sda, int scl)
+{
+  trace_decoder_t *dec = &decoders[bus];
+  uint8_t now = (sda ? TRACE_SDA : 0) | (scl ? TRACE_SCL : 0);
+
+  /* each bus is only driven by one thread at a time, so this needs no lock */
+  if (now == dec->lines) return;
+
+  chSysLock ();
+  if (state == TRACE_ARMED || state == TRACE_TRIGGERED)
+  {
+    trace_decode (dec, now, chSysGetRealtimeCounterX());
+  }
+  chSysUnlock ();
+}
+
+/* start a new capture keeping about 'pretrigger' bytes of records before the trigger */
+void trace_arm (trace_trigger_t kind, uint8_t address, uint16_t pretrigger)
+{
+  uint8_t bus;
+
+  chSysLock ();
+  trigger = kind;
+  triggerAddress = address;
+  pre = pretrigger < TRACE_BYTES / 2 ? pretrigger : TRACE_BYTES / 2;
+  triggerAt = TRACE_BYTES;
+  head = 0;
+  tail = 0;
+  used = 0;
+  last = base = chSysGetRealtimeCounterX();
+  for (bus = 0; bus < 2; bus++)
+  {
+    decoders[bus].lines = TRACE_SDA | TRACE_SCL;
+    decoders[bus].bits = TRACE_IDLE_BITS;
+    decoders[bus].count = 0;
+    decoders[bus].fire = 0;
+  }
+  state = TRACE_ARMED;
+  trace_recording = 1;
+  chSysUnlock ();
+}
+
+/* freeze the capture without waiting for the trigger */
+void trace_stop (void)
+{
+  chSysLock ();
+  trace_recording = 0;
+  if (state == TRACE_ARMED || state == TRACE_TRIGGERED) state = TRACE_DONE;
+  chSysUnlock ();
+}
+
+trace_state_t trace_state (void)
+{
+  return state;
+}
+
+static int trace_triggered (void)
+{
+  return triggerAt != TRACE_BYTES;
+}
+
+/* decoded listing, times in microseconds relative to the trigger */
+void trace_dump (BaseSequentialStream *chp)
+{
+  uint16_t offset = tail, start, seen = 0;
+  uint32_t t = base, reference = base, duration;
+  uint8_t header, data;
+  int32_t us;
+
+  if (state != TRACE_DONE)
+  {
+    chprintf (chp, "No capture, %u bytes recorded so far\r\n", used);
+    return;
+  }
+
+  if (trace_triggered ())
+  { /* find the time of the trigger record first */
+    while (offset != triggerAt)
+    {
+      t += (uint32_t)trace_get_record (&offset, &header, &data, &duration) << TRACE_TIME_SHIFT;
+    }
+    reference = t + ((uint32_t)trace_get_record (&offset, &header, &data, &duration) << TRACE_TIME_SHIFT);
+    offset = tail;
+    t = base;
+  }
+
+  while (seen < used) /* head equals tail when the ring is full */
+  {
+    start = offset;
+    t += (uint32_t)trace_get_record (&offset, &header, &data, &duration) << TRACE_TIME_SHIFT;
+    seen += (offset + TRACE_BYTES - start) % TRACE_BYTES;
+    us = (int32_t)(t - reference) / (int32_t)(STM32_HCLK / 1000000);
+
+    chprintf (chp, "%c %9d %-7s ", (trace_triggered () && start == triggerAt) ? '*' : ' ', us,
+              (header & TRACE_MONITOR) ? "monitor" : "host");
+    if (header & TRACE_BYTE)
+    {
+      chprintf (chp, "%s%02x %s in %u us\r\n", (header & TRACE_FIRST) ? "@" : "", data,
+                (header & TRACE_NACK) ? "NACK" : "ACK",
+                (duration << TRACE_TIME_SHIFT) / (STM32_HCLK / 1000000));
+    }
+    else
+    {
+      chprintf (chp, "SDA=%d SCL=%d\r\n", (header & TRACE_SDA) ? 1 : 0, (header & TRACE_SCL) ? 1 : 0);
+    }
+  }
+}
+
+/* the frozen ring as trace_header_t and records, for tools/tracedecode.py */
+void trace_dump_binary (BaseSequentialStream *chp)
+{
+  trace_header_t header;
+  uint16_t first;
+
+  if (state != TRACE_DONE) return;
+
+  memcpy (header.magic, "DDCT", 4);
+  header.version = 1;
+  header.shift = TRACE_TIME_SHIFT;
+  header.reserved = 0;
+  header.clock = STM32_HCLK;
+  header.base = base;
+  header.trigger = trace_triggered () ? (uint32_t)(triggerAt + TRACE_BYTES - tail) % TRACE_BYTES : 0xFFFFFFFF;
+  header.length = used;
+  chSequentialStreamWrite (chp, (uint8_t *)&header, sizeof(header));
+
+  first = TRACE_BYTES - tail < used ? TRACE_BYTES - tail : used;
+  chSequentialStreamWrite (chp, &ring[tail], first);
+  if (first < used) chSequentialStreamWrite (chp, ring, used - first);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Size of the encoded capture in CCM */
+#define TRACE_BYTES 6144
+
+/* Timestamps are stored in units of 2^TRACE_TIME_SHIFT CPU cycles */
+#define TRACE_TIME_SHIFT 4
+
+typedef enum
+{
+    TRACE_BUS_HOST,
+    TRACE_BUS_MONITOR
+} trace_bus_t;
+
+typedef enum
+{
+    TRACE_TRIGGER_START,    /* any START condition */
+    TRACE_TRIGGER_ADDRESS,  /* START followed by the given address byte */
+    TRACE_TRIGGER_NACK      /* a byte was not acknowledged */
+} trace_trigger_t;
+
+typedef enum
+{
+    TRACE_IDLE,       /* nothing captured */
+    TRACE_ARMED,      /* recording, waiting for the trigger */
+    TRACE_TRIGGERED,  /* recording what follows the trigger */
+    TRACE_DONE        /* capture is frozen and can be dumped */
+} trace_state_t;
+
+/*
+ * Encoded records, each starts with a header byte followed by the time
+ * since the previous record as zigzag varint (it is negative when a
+ * byte record of one bus ends after a record of the other bus):
+ *
+ *   lines  0 M 0 0 0 0 D C  delta
+ *   byte   1 M F 0 0 0 0 N  delta data duration
+ *
+ * M: monitor bus, D/C: SDA/SCL level after the transition, F: first
+ * byte after START, N: byte was NACKed. A byte record replaces all
+ * transitions of a byte and its ACK bit; its time is the final SCL
+ * fall, 'duration' (varint) reaches back to its first transition.
+ */
+#define TRACE_SDA     0x01
+#define TRACE_SCL     0x02
+#define TRACE_NACK    0x01
+#define TRACE_FIRST   0x20
+#define TRACE_MONITOR 0x40
+#define TRACE_BYTE    0x80
+
+/* Header of a binary dump, followed by 'length' bytes of records */
+typedef struct __attribute__((packed))
+{
+    uint8_t  magic[4];    /* "DDCT" */
+    uint8_t  version;     /* 1 */
+    uint8_t  shift;       /* TRACE_TIME_SHIFT */
+    uint16_t reserved;
+    uint32_t clock;       /* CPU cycles per second */
+    uint32_t base;        /* time before the first record, in cycles */
+    uint32_t trigger;     /* offset of the trigger record or 0xFFFFFFFF */
+    uint32_t length;
+} trace_header_t;
+
+extern volatile uint8_t trace_recording;
+
+void trace_sample (trace_bus_t bus, int sda, int scl);
+
+/* called by the bus code on every line access, only costs a test when idle */
+static inline void trace_lines (trace_bus_t bus, int sda, int scl)
+{
+    if (trace_recording) trace_sample (bus, sda, scl);
+}
+
+void trace_arm (trace_trigger_t trigger, uint8_t address, uint16_t pretrigger);
+void trace_stop (void);
+trace_state_t trace_state (void);
+void trace_dump (BaseSequentialStream *chp);
+void trace_dump_binary (BaseSequentialStream *chp);
+
+#endif // TRACE_H
@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Monitor-side worker. The host-facing proxy loop hands DDC/CI requests
+ * to this thread and keeps serving the host bus; until the reply of the
+ * latest request is available, the host gets DDC/CI null messages.
+ * Requests are queued in order, write-only requests like table write
+ * fragments are streamed to the monitor one frame at a time.
+ *
+ * Every job is due when its host will look for the reply: the monitor
+ * needs its reply delay and the bus transfers even when nothing else is
+ * waiting, the host waits the window of its opcode on top. Of the jobs
+ * waiting, the one due first runs next; jobs that finish late, because
+ * others went first or had to be retried, are counted per monitor bus.
+ * Background work like the VCP mirror only runs while the queue is
+ * empty, and gives way during its reply delay when a host request comes
+ * in: the display drops the background request once it gets the new one.
+ *
+ * Every port has a worker of its own. Workers run below the priority of
+ * the proxy threads, so they only get the CPU while no host transfer is
+ * being followed.
+ *
+ * In KVM mode the hosts of several ports share the worker of one monitor,
+ * with its reply and EDID cache. Each host has its own latest request and
+ * reply; a request that another host has queued or in flight is answered
+ * by that one transaction.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "bbi2c.h"
+#include "ddcci.h"
+#include "upstream.h"
+#include "port.h"
+#include "log.h"
+#include "stats.h"
+#include "correlate.h"
+
+#define CYCLES_PER_US (STM32_HCLK / 1000000)
+
+/* background request waiting for the worker to have nothing else to do */
+typedef struct upstream_background
+{
+  uint8_t *frame;
+  const ddcci_opcode_t *op;
+  uint8_t *result;
+  int status;
+  binary_semaphore_t done;
+} upstream_background_t;
+
+/* shared by the workers of all ports, so sequence numbers identify a request board-wide */
+static volatile uint32_t sequence;
+
+/* the cache key is the request without address, source and length bytes */
+static upstream_cache_t * upstream_cache_lookup (upstream_t *up, uint8_t *stream)
+{
+  uint8_t len = ddcci_frame_length (stream);
+  uint8_t i;
+
+  for (i = 0; i < up->cacheUsed; i++)
+  {
+    if (up->cache[i].keyLength == len - 3 && memcmp (up->cache[i].key, &stream[3], len - 3) == 0)
+    {
+      return &up->cache[i];
+    }
+  }
+  return NULL;
+}
+
+static void upstream_cache_store (upstream_t *up, uint8_t *stream, uint8_t *reply)
+{
+  upstream_cache_t *entry;
+  uint8_t len = ddcci_frame_length (stream);
+
+  if (len - 3 > UPSTREAM_CACHE_KEY) return;
+
+  entry = upstream_cache_lookup (up, stream);
+  if (!entry)
+  {
+    if (up->cacheUsed < UPSTREAM_CACHE_ENTRIES)
+    {
+      entry = &up->cache[up->cacheUsed++];
+    }
+    else
+    {
+      entry = &up->cache[up->cacheNext];
+      up->cacheNext = (up->cacheNext + 1) % UPSTREAM_CACHE_ENTRIES;
+    }
+  }
+
+  memcpy (entry->key, &stream[3], len - 3);
+  entry->keyLength = len - 3;
+  memcpy (entry->reply, reply, (reply[1] & 0x7F) + 3);
+  entry->stored = chVTGetSystemTimeX();
+}
+
+/*
+ * Drop cached replies to 'opcode' requests for the table or VCP code the
+ * request 'stream' writes, or for all codes if it has none (save settings).
+ */
+static void upstream_cache_invalidate (upstream_t *up, uint8_t opcode, uint8_t *stream)
+{
+  uint8_t all = ddcci_frame_length (stream) < 5;
+  uint8_t i = 0;
+
+  while (i < up->cacheUsed)
+  {
+    if (up->cache[i].key[0] == opcode &&
+        (all || (up->cache[i].keyLength > 1 && up->cache[i].key[1] == stream[4])))
+    {
+      up->cache[i] = up->cache[--up->cacheUsed];
+      up->cacheNext = 0;
+    }
+    else i++;
+  }
+}
+
+/* forward a sealed request to the monitor and fetch its reply, retrying on failure and while the monitor is busy */
+static int upstream_transfer (upstream_t *up, uint8_t *frame, const ddcci_opcode_t *op, uint8_t *result)
+{
+  uint8_t retry;
+
+  for (retry = 0; retry < UPSTREAM_RETRIES; retry++)
+  {
+    if (retry) stats_inc (&up->port->stats_monitor, STATS_RETRY);
+    if (ddcci_write_slave (up->port, frame) < 0)
+    {
+      LOG_EVENT (LOG_UPSTREAM_WRITE_FAILED, 0, 0);
+      continue;
+    }
+    if (op->reply == DDCCI_REPLY_NONE) return 0;
+    if (ddcci_read_slave (up->port, result) == 0)
+    {
+      /* a null message means busy, ask again; anything else must answer the request */
+      if (checkNullMessage (result[1])) continue;
+      if (result[2] == op->reply_opcode) return 0;
+      LOG_EVENT (LOG_UPSTREAM_UNEXPECTED, result[2], (uintptr_t)op->name);
+      continue;
+    }
+    LOG_EVENT (LOG_UPSTREAM_READ_FAILED, 0, 0);
+  }
+  return -1;
+}
+
+/* next job due: the one with the earliest deadline among the oldest job of each host, NULL if none */
+static upstream_job_t * upstream_next (upstream_t *up)
+{
+  upstream_job_t *oldest[UPSTREAM_CLIENTS] = {NULL};
+  upstream_job_t *job, *best = NULL;
+  uint8_t c, i;
+
+  for (i = 0; i < UPSTREAM_QUEUE_DEPTH * UPSTREAM_CLIENTS; i++)
+  {
+    job = &up->queue[i];
+    if (job->op && (!oldest[job->owner] || (int32_t)(job->order - oldest[job->owner]->order) < 0))
+    {
+      oldest[job->owner] = job;
+    }
+  }
+  for (c = 0; c < UPSTREAM_CLIENTS; c++)
+  {
+    if (oldest[c] && (!best || (int32_t)(oldest[c]->deadline - best->deadline) < 0)) best = oldest[c];
+  }
+  return best;
+}
+
+/*
+ * Background request in the slack of the queue. While the display prepares
+ * its reply, a host request arriving takes over; the display drops the
+ * background request when it gets the next one.
+ */
+static int upstream_slack (upstream_t *up, upstream_background_t *bg)
+{
+  int status = -1;
+
+  chMtxLock (&up->bus);
+  if (ddcci_write_slave (up->port, bg->frame) == 0)
+  {
+    if (bg->op->reply == DDCCI_REPLY_NONE) status = 0;
+    else if (chSemWaitTimeout (&up->pending, MS2ST (up->port->timing.reply_delay_ms)) == MSG_OK)
+    {
+      chSemSignal (&up->pending); /* the job is still queued, count it again */
+      stats_inc (&up->port->stats_monitor, STATS_PREEMPTED);
+    }
+    else status = ddcci_read_reply (up->port, bg->result);
+  }
+  chMtxUnlock (&up->bus);
+
+  return status;
+}
+
+/* count a job that finished after its host looked for the reply */
+static void upstream_deadline (upstream_t *up, upstream_job_t *job, rtcnt_t end)
+{
+  if ((int32_t)(end - job->deadline) <= 0) return;
+
+  stats_inc (&up->port->stats_monitor, STATS_DEADLINE);
+  stats_add (&up->port->stats_monitor, STATS_LATE_US, (end - job->deadline) / CYCLES_PER_US);
+}
+
+/* both frames carry the same request */
+static uint8_t upstream_same (uint8_t *a, uint8_t *b)
+{
+  return a == b || (a[2] == b[2] && memcmp (a, b, ddcci_frame_length (a)) == 0);
+}
+
+/* queued or executing job with the same request, its reply can be shared */
+static upstream_job_t * upstream_find (upstream_t *up, uint8_t *frame)
+{
+  uint8_t i;
+
+  if (up->busy && up->active.op->reply != DDCCI_REPLY_NONE &&
+      upstream_same (up->active.frame, frame)) return &up->active;
+
+  for (i = 0; i < UPSTREAM_QUEUE_DEPTH * UPSTREAM_CLIENTS; i++)
+  {
+    if (up->queue[i].op && upstream_same (up->queue[i].frame, frame))
+    {
+      return &up->queue[i];
+    }
+  }
+  return NULL;
+}
+
+/* some host still waits for the reply of 'job' */
+static uint8_t upstream_wanted (upstream_t *up, upstream_job_t *job)
+{
+  uint8_t c;
+
+  for (c = 0; c < UPSTREAM_CLIENTS; c++)
+  {
+    if ((job->clients & (1 << c)) && job->sequence[c] == up->client[c].requested) return 1;
+  }
+  return 0;
+}
+
+static THD_FUNCTION(upstreamThread, arg)
+{
+  upstream_t *up = arg;
+  upstream_job_t *job = &up->active;
+  upstream_job_t *next;
+  upstream_background_t *bg;
+  upstream_client_t *client;
+  uint8_t result[DDCCI_FRAME_MAX];
+  const ddcci_opcode_t *op;
+  int status;
+  rtcnt_t start, end;
+  uint8_t c;
+
+  chRegSetThreadName("upstream");
+
+  for (;;)
+  {
+    chSemWait (&up->pending);
+
+    chMtxLock (&up->lock);
+    next = upstream_next (up);
+    if (!next)
+    { /* nothing queued, woken for background work */
+      bg = up->background;
+      up->background = NULL;
+      chMtxUnlock (&up->lock);
+      if (bg)
+      {
+        bg->status = upstream_slack (up, bg);
+        chBSemSignal (&bg->done);
+      }
+      continue;
+    }
+    *job = *next;
+    next->op = NULL; /* slot free again */
+    up->client[job->owner].queued--;
+    up->queueCount--;
+    op = job->op;
+    if (op->reply != DDCCI_REPLY_NONE && !upstream_wanted (up, job))
+    { /* nobody is waiting for this reply any more */
+      chMtxUnlock (&up->lock);
+      ddcci_frame_free (job->frame);
+      continue;
+    }
+    up->busy = 1;
+    chMtxUnlock (&up->lock);
+
+    chMtxLock (&up->bus);
+    start = chSysGetRealtimeCounterX();
+    status = upstream_transfer (up, job->frame, op, result);
+    end = chSysGetRealtimeCounterX();
+    chMtxUnlock (&up->bus);
+    upstream_deadline (up, job, end);
+
+    chMtxLock (&up->lock);
+    up->busy = 0;
+    if (status == 0 && op->cache != DDCCI_CACHE_NONE)
+    {
+      upstream_cache_store (up, job->frame, result);
+    }
+    if (op->invalidates)
+    { /* a read that ran while this one was queued may have stored the old value */
+      upstream_cache_invalidate (up, op->invalidates, job->frame);
+    }
+    for (c = 0; c < UPSTREAM_CLIENTS; c++)
+    {
+      client = &up->client[c];
+      if (!(job->clients & (1 << c))) continue;
+      correlate_monitor (job->sequence[c], start, end, status);
+      if (job->sequence[c] != client->requested) continue; /* superseded, the newer one is pending */
+      if (status == 0 && op->reply != DDCCI_REPLY_NONE)
+      {
+        memcpy (client->answer, result, (result[1] & 0x7F) + 3);
+      }
+      client->failed = (status != 0);
+      client->completed = job->sequence[c];
+    }
+    chMtxUnlock (&up->lock);
+    ddcci_frame_free (job->frame);
+  }
+}
+
+/* set up the worker for the monitor of 'port', once at boot */
+void upstream_start (upstream_t *up, struct port *port)
+{
+  if (up->worker) return;
+
+  up->port = port;
+  chMtxObjectInit (&up->lock);
+  chMtxObjectInit (&up->bus);
+  chSemObjectInit (&up->pending, 0);
+  up->worker = chThdCreateStatic (up->workerWA, sizeof(up->workerWA), NORMALPRIO-1, upstreamThread, up);
+}
+
+/*
+ * Queue a request of host 'client' for the monitor. Repeating the request
+ * while it is in flight is a no-op, once it is answered or failed the same
+ * request goes to the monitor again. A request another host already has queued or in
+ * flight is not sent twice, both get the reply of the one transaction.
+ *
+ * 'frame' is a sealed frame from the pool. It is not copied, the worker
+ * takes its own reference and the caller still frees its one.
+ */
+void upstream_submit (upstream_t *up, uint8_t client, uint8_t *frame, const ddcci_opcode_t *op)
+{
+  upstream_client_t *cl = &up->client[client];
+  upstream_cache_t *entry;
+  upstream_job_t *job;
+  uint8_t i;
+
+  chMtxLock (&up->lock);
+  if (cl->request && upstream_same (frame, cl->request) && cl->completed != cl->requested)
+  {
+    chMtxUnlock (&up->lock);
+    return;
+  }
+
+  if (cl->request) ddcci_frame_free (cl->request);
+  ddcci_frame_ref (frame);
+  cl->request = frame;
+  cl->requestOp = op;
+  cl->requested = __atomic_add_fetch (&sequence, 1, __ATOMIC_RELAXED);
+
+  /* reads queued behind this write must not be answered from the cache */
+  if (op->invalidates) upstream_cache_invalidate (up, op->invalidates, frame);
+
+  entry = (op->cache != DDCCI_CACHE_NONE) ? upstream_cache_lookup (up, frame) : NULL;
+  if (entry && op->cache == DDCCI_CACHE_VOLATILE &&
+      chVTTimeElapsedSinceX (entry->stored) >= MS2ST (UPSTREAM_VOLATILE_MS)) entry = NULL;
+  if (op->cache != DDCCI_CACHE_NONE)
+  {
+    stats_inc (&up->port->stats_monitor, entry ? STATS_CACHE_HIT : STATS_CACHE_MISS);
+  }
+  if (entry) /* answered without touching the monitor */
+  {
+    memcpy (cl->answer, entry->reply, (entry->reply[1] & 0x7F) + 3);
+    cl->failed = 0;
+    cl->completed = cl->requested;
+    chMtxUnlock (&up->lock);
+    return;
+  }
+
+  job = (op->reply != DDCCI_REPLY_NONE) ? upstream_find (up, frame) : NULL;
+  if (job)
+  {
+    if (job->clients & ~(1 << client)) stats_inc (&up->port->stats_monitor, STATS_MERGED);
+    job->clients |= 1 << client;
+    job->sequence[client] = cl->requested;
+    chMtxUnlock (&up->lock);
+    return;
+  }
+
+  if (cl->queued == UPSTREAM_QUEUE_DEPTH)
+  {
+    cl->failed = 1; /* the host retries and finds a free slot later */
+    cl->completed = cl->requested;
+    chMtxUnlock (&up->lock);
+    LOG_EVENT (LOG_UPSTREAM_QUEUE_FULL, (uintptr_t)op->name, 0);
+    return;
+  }
+
+  /* every host has UPSTREAM_QUEUE_DEPTH slots, a free one is left */
+  for (i = 0; up->queue[i].op; i++);
+  job = &up->queue[i];
+  ddcci_frame_ref (frame);
+  job->frame = frame;
+  job->op = op;
+  job->deadline = chSysGetRealtimeCounterX() +
+      (ddcci_transaction_us (&up->port->timing, ddcci_frame_length (frame) + 1, op->reply != DDCCI_REPLY_NONE) +
+       op->window_ms * 1000) * CYCLES_PER_US;
+  job->owner = client;
+  job->clients = 1 << client;
+  job->sequence[client] = cl->requested;
+  job->order = up->order++;
+  cl->queued++;
+  up->queueCount++;
+  chMtxUnlock (&up->lock);
+
+  chSemSignal (&up->pending);
+}
+
+/* copy the reply to the latest request of host 'client', returns its length or 0 if not ready */
+uint8_t upstream_reply (upstream_t *up, uint8_t client, uint8_t *reply)
+{
+  upstream_client_t *cl = &up->client[client];
+  uint8_t len = 0;
+
+  chMtxLock (&up->lock);
+  if (cl->completed == cl->requested && !cl->failed && cl->requestOp && cl->requestOp->reply != DDCCI_REPLY_NONE)
+  {
+    len = (cl->answer[1] & 0x7F) + 3;
+    memcpy (reply, cl->answer, len);
+  }
+  chMtxUnlock (&up->lock);
+
+  return len;
+}
+
+/* sequence number of the latest request from host 'client' */
+uint32_t upstream_sequence (upstream_t *up, uint8_t client)
+{
+  return up->client[client].requested;
+}
+
+/* nothing queued for the monitor, background users may take the bus now */
+uint8_t upstream_idle (upstream_t *up)
+{
+  uint8_t idle;
+
+  chMtxLock (&up->lock);
+  idle = (up->queueCount == 0 && !up->busy);
+  chMtxUnlock (&up->lock);
+
+  return idle;
+}
+
+/*
+ * EDID of the monitor, read on first use and then shared by all hosts.
+ * Returns 1 if just read, 0 if from the cache, -1 if the monitor did not
+ * answer and 'edid' starts with 0xFF.
+ */
+int upstream_edid (upstream_t *up, uint8_t *edid)
+{
+  int status = 0;
+
+  chMtxLock (&up->bus);
+  if (!up->edidValid)
+  {
+    up->edidValid = (read_edid (up->port, up->edid) == 0);
+    status = up->edidValid ? 1 : -1;
+  }
+  memcpy (edid, up->edid, EDID_LENGTH);
+  chMtxUnlock (&up->bus);
+
+  return status;
+}
+
+/* synchronous request on behalf of the proxy itself, bypasses queue and cache */
+int upstream_query (upstream_t *up, uint8_t *frame, const ddcci_opcode_t *op, uint8_t *result)
+{
+  int status;
+
+  chMtxLock (&up->bus);
+  status = upstream_transfer (up, frame, op, result);
+  chMtxUnlock (&up->bus);
+
+  return status;
+}
+
+/*
+ * Request on behalf of background work like the VCP mirror, run by the
+ * worker once no host job is waiting. Returns -1 right away if there is
+ * host traffic, or if a host request arrived before the reply was read.
+ */
+int upstream_background (upstream_t *up, uint8_t *frame, const ddcci_opcode_t *op, uint8_t *result)
+{
+  upstream_background_t bg;
+
+  bg.frame = frame;
+  bg.op = op;
+  bg.result = result;
+  bg.status = -1;
+  chBSemObjectInit (&bg.done, TRUE);
+
+  chMtxLock (&up->lock);
+  if (up->background || up->queueCount || up->busy)
+  {
+    chMtxUnlock (&up->lock);
+    return -1;
+  }
+  up->background = &bg;
+  chMtxUnlock (&up->lock);
+
+  chSemSignal (&up->pending);
+  chBSemWait (&bg.done);
+
+  return bg.status;
+}
+
+/* exclusive use of the monitor-side bus for bulk operations like a VCP scan */
+void upstream_acquire (upstream_t *up)
+{
+  chMtxLock (&up->bus);
+}
+
+void upstream_release (upstream_t *up)
+{
+  chMtxUnlock (&up->bus);
+}
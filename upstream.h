@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016, Alexander Senier <alexander.senier@tu-dresden.de>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include "opcodes.h"
+
+/* Attempts per request before the monitor is considered unreachable */
+#define UPSTREAM_RETRIES 5
+
+/* Replies kept for opcodes with DDCCI_CACHE_REPLY or _VOLATILE, keyed by the request */
+#define UPSTREAM_CACHE_ENTRIES 48
+#define UPSTREAM_CACHE_KEY     8
+
+/* Age up to which a DDCCI_CACHE_VOLATILE reply is served, the OSD may have changed it since */
+#define UPSTREAM_VOLATILE_MS 1000
+
+/* Requests of one host waiting for the monitor */
+#define UPSTREAM_QUEUE_DEPTH 4
+
+/* Hosts one worker serves at most, the ports sharing a monitor in KVM mode */
+#define UPSTREAM_CLIENTS 2
+
+typedef struct
+{
+  uint8_t key[UPSTREAM_CACHE_KEY];  /* request from the opcode on */
+  uint8_t keyLength;
+  uint8_t reply[DDCCI_FRAME_MAX];
+  systime_t stored;
+} upstream_cache_t;
+
+typedef struct
+{
+  uint8_t *frame;                   /* sealed request from the frame pool, held by the job */
+  const ddcci_opcode_t *op;         /* NULL for a free queue slot */
+  rtcnt_t deadline;                 /* the host expects the reply by then, see upstream_submit */
+  uint8_t owner;                    /* host that queued the job */
+  uint8_t clients;                  /* hosts waiting for the reply, a bit each */
+  uint32_t sequence[UPSTREAM_CLIENTS];  /* request of each of them the reply answers */
+  uint32_t order;                   /* arrival, jobs of one host run in order */
+} upstream_job_t;
+
+/* Latest request of one host and the reply to it */
+typedef struct
+{
+  uint8_t  *request;    /* pool frame, held until the next request replaces it */
+  const ddcci_opcode_t *requestOp;
+  uint32_t requested;  /* sequence number of the latest request */
+  uint32_t completed;  /* sequence number the current result belongs to */
+  uint8_t  failed;
+  uint8_t  answer[DDCCI_FRAME_MAX];
+  uint8_t  queued;     /* jobs of this host in the queue */
+} upstream_client_t;
+
+/* Monitor-side worker of one port, with its request queue and reply cache */
+typedef struct upstream
+{
+  struct port *port;
+
+  /* earliest deadline first, the jobs of each host in order so table write fragments are never lost */
+  upstream_job_t queue[UPSTREAM_QUEUE_DEPTH * UPSTREAM_CLIENTS];
+  uint8_t queueCount;
+  uint32_t order;
+  upstream_job_t active;  /* job the worker is executing */
+  struct upstream_background *background;  /* runs once the queue is empty */
+
+  upstream_client_t client[UPSTREAM_CLIENTS];
+
+  upstream_cache_t cache[UPSTREAM_CACHE_ENTRIES];
+  uint8_t cacheUsed;
+  uint8_t cacheNext;  /* replaced next when the cache is full */
+
+  uint8_t edid[EDID_LENGTH];  /* read from the monitor once, for all hosts */
+  uint8_t edidValid;
+
+  uint8_t busy;  /* worker is talking to the monitor */
+
+  mutex_t lock;
+  mutex_t bus;  /* serializes all users of the monitor-side bus */
+  semaphore_t pending;
+  thread_t *worker;
+  THD_WORKING_AREA(workerWA, 1024);
+} upstream_t;
+
+void upstream_start (upstream_t *up, struct port *port);
+void upstream_submit (upstream_t *up, uint8_t client, uint8_t *frame, const ddcci_opcode_t *op);
+uint8_t upstream_reply (upstream_t *up, uint8_t client, uint8_t *reply);
+uint32_t upstream_sequence (upstream_t *up, uint8_t client);
+uint8_t upstream_idle (upstream_t *up);
+int upstream_edid (upstream_t *up, uint8_t *edid);
+void upstream_acquire (upstream_t *up);
+void upstream_release (upstream_t *up);
+int upstream_query (upstream_t *up, uint8_t *frame, const ddcci_opcode_t *op, uint8_t *result);
+int upstream_background (upstream_t *up, uint8_t *frame, const ddcci_opcode_t *op, uint8_t *result);
+
+#endif // UPSTREAM_H